@@ -0,0 +1,333 @@
+/* SPDX-License-Identifier: Zlib */
+
+#include <math.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <glib.h>
+
+#include "bench.h"
+#include "plugin.h"
+#include "render.h"
+#include "thumbnail.h"
+#include "utils.h"
+
+static gchar* scales_option   = "0.5,1,2";
+static gchar* search_option   = "the";
+static gint iterations_option = 1;
+static gint preview_option    = 4;
+static gint thumbnail_option  = 128;
+
+static GOptionEntry option_entries[] = {
+    {"scales", 's', 0, G_OPTION_ARG_STRING, &scales_option, "Comma separated render scales", "SCALES"},
+    {"search", 'q', 0, G_OPTION_ARG_STRING, &search_option, "Text searched on every page", "TEXT"},
+    {"iterations", 'n', 0, G_OPTION_ARG_INT, &iterations_option, "Renders of every page per scale", "N"},
+    {"preview", 'p', 0, G_OPTION_ARG_INT, &preview_option, "Resolution reduction of previews", "N"},
+    {"thumbnails", 't', 0, G_OPTION_ARG_INT, &thumbnail_option, "Edge length of thumbnails", "PIXELS"},
+    {NULL, 0, 0, 0, NULL, NULL, NULL},
+};
+
+static gint bench_compare(gconstpointer a, gconstpointer b) {
+  const gint64 x = *(const gint64*)a;
+  const gint64 y = *(const gint64*)b;
+
+  return (x > y) - (x < y);
+}
+
+/* nearest-rank percentile of sorted samples, in milliseconds */
+static double bench_percentile(GArray* samples, double percentile) {
+  guint rank = (guint)ceil(percentile / 100.0 * samples->len);
+  guint i    = rank > 0 ? rank - 1 : 0;
+
+  return g_array_index(samples, gint64, MIN(i, samples->len - 1)) / 1000.0;
+}
+
+static void bench_print_string(const char* string) {
+  putchar('"');
+  for (const unsigned char* c = (const unsigned char*)string; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      printf("\\%c", *c);
+    } else if (*c < 0x20) {
+      printf("\\u%04x", *c);
+    } else {
+      putchar(*c);
+    }
+  }
+  putchar('"');
+}
+
+static void bench_print_samples(const char* name, GArray* samples) {
+  printf("      ");
+  bench_print_string(name);
+  printf(": {\"count\": %u", samples->len);
+
+  if (samples->len > 0) {
+    g_array_sort(samples, bench_compare);
+
+    gint64 total = 0;
+    for (guint i = 0; i < samples->len; i++) {
+      total += g_array_index(samples, gint64, i);
+    }
+
+    printf(", \"total_ms\": %.3f, \"min_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, "
+           "\"max_ms\": %.3f",
+           total / 1000.0, bench_percentile(samples, 0), bench_percentile(samples, 50), bench_percentile(samples, 90),
+           bench_percentile(samples, 99), bench_percentile(samples, 100));
+  }
+
+  printf("}");
+  g_array_set_size(samples, 0);
+}
+
+static void bench_add_sample(GArray* samples, gint64 start) {
+  gint64 duration = g_get_monotonic_time() - start;
+  g_array_append_val(samples, duration);
+}
+
+static void bench_file(const char* path, double* scales, guint n_scales, bool first) {
+  GArray* samples              = g_array_new(FALSE, FALSE, sizeof(gint64));
+  zathura_document_t* document = bench_document_new(path);
+
+  printf("%s    {\n      \"path\": ", first == true ? "" : ",\n");
+  bench_print_string(path);
+
+  gint64 start          = g_get_monotonic_time();
+  zathura_error_t error = pdf_document_open(document);
+  if (error != ZATHURA_ERROR_OK) {
+    printf(",\n      \"error\": %d\n    }", error);
+    bench_document_free(document);
+    g_array_free(samples, TRUE);
+    return;
+  }
+  bench_add_sample(samples, start);
+
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  unsigned int n_pages             = bench_document_get_number_of_pages(document);
+  zathura_page_t** pages           = g_new0(zathura_page_t*, n_pages);
+
+  printf(",\n      \"pages\": %u,\n", n_pages);
+  bench_print_samples("open", samples);
+  printf(",\n");
+
+  for (unsigned int i = 0; i < n_pages; i++) {
+    pages[i] = bench_page_new(document, i);
+    start    = g_get_monotonic_time();
+    if (pdf_page_init(pages[i]) == ZATHURA_ERROR_OK) {
+      bench_add_sample(samples, start);
+    }
+  }
+  bench_print_samples("page_init", samples);
+  printf(",\n");
+
+  /* text is extracted before anything is rendered, so that no display list is replayed */
+  for (unsigned int i = 0; i < n_pages; i++) {
+    mupdf_page_t* mupdf_page = bench_page_get_data(pages[i]);
+    if (mupdf_page == NULL) {
+      continue;
+    }
+
+    g_mutex_lock(&mupdf_page->mutex);
+    start = g_get_monotonic_time();
+    mupdf_page_get_text(mupdf_document, mupdf_page);
+    bench_add_sample(samples, start);
+    g_mutex_unlock(&mupdf_page->mutex);
+  }
+  bench_print_samples("extract_text", samples);
+  printf(",\n");
+
+  for (unsigned int i = 0; i < n_pages; i++) {
+    void* data = bench_page_get_data(pages[i]);
+    if (data == NULL) {
+      continue;
+    }
+
+    start                  = g_get_monotonic_time();
+    girara_list_t* results = pdf_page_search_text(pages[i], data, search_option, &error);
+    bench_add_sample(samples, start);
+    if (results != NULL) {
+      girara_list_free(results);
+    }
+  }
+  bench_print_samples("search", samples);
+  printf(",\n");
+
+  /* thumbnails come first, so that they interpret the pages like a freshly opened document */
+  cairo_surface_t** thumbnails = g_new0(cairo_surface_t*, n_pages);
+  start                        = g_get_monotonic_time();
+  if (mupdf_document_render_thumbnails(document, mupdf_document, pages, n_pages, thumbnail_option, thumbnails) ==
+      ZATHURA_ERROR_OK) {
+    bench_add_sample(samples, start);
+  }
+  for (unsigned int i = 0; i < n_pages; i++) {
+    if (thumbnails[i] != NULL) {
+      cairo_surface_destroy(thumbnails[i]);
+    }
+  }
+  g_free(thumbnails);
+  bench_print_samples("thumbnails", samples);
+
+  for (guint s = 0; s < n_scales; s++) {
+    for (gint n = 0; n < iterations_option; n++) {
+      for (unsigned int i = 0; i < n_pages; i++) {
+        void* data = bench_page_get_data(pages[i]);
+        if (data == NULL) {
+          continue;
+        }
+
+        int width                = ceil(zathura_page_get_width(pages[i]) * scales[s]);
+        int height               = ceil(zathura_page_get_height(pages[i]) * scales[s]);
+        cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+        cairo_t* cairo           = cairo_create(surface);
+
+        start = g_get_monotonic_time();
+        if (pdf_page_render_cairo(pages[i], data, cairo, false) == ZATHURA_ERROR_OK) {
+          bench_add_sample(samples, start);
+        }
+
+        cairo_destroy(cairo);
+        cairo_surface_destroy(surface);
+      }
+    }
+
+    gchar* name = g_strdup_printf("render@%g", scales[s]);
+    printf(",\n");
+    bench_print_samples(name, samples);
+    g_free(name);
+
+    /* previews replay the display lists built by the full renders */
+    for (unsigned int i = 0; i < n_pages; i++) {
+      void* data = bench_page_get_data(pages[i]);
+      if (data == NULL) {
+        continue;
+      }
+
+      int width                = ceil(zathura_page_get_width(pages[i]) * scales[s]);
+      int height               = ceil(zathura_page_get_height(pages[i]) * scales[s]);
+      cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+      cairo_t* cairo           = cairo_create(surface);
+
+      start = g_get_monotonic_time();
+      if (mupdf_page_render_cairo_preview(pages[i], data, cairo, preview_option) == ZATHURA_ERROR_OK) {
+        bench_add_sample(samples, start);
+      }
+
+      cairo_destroy(cairo);
+      cairo_surface_destroy(surface);
+    }
+
+    name = g_strdup_printf("preview@%g", scales[s]);
+    printf(",\n");
+    bench_print_samples(name, samples);
+    g_free(name);
+  }
+
+  for (unsigned int i = 0; i < n_pages; i++) {
+    void* data = bench_page_get_data(pages[i]);
+    if (data != NULL) {
+      pdf_page_clear(pages[i], data);
+    }
+    bench_page_free(pages[i]);
+  }
+  g_free(pages);
+
+  printf("\n    }");
+
+  pdf_document_free(document, mupdf_document);
+  bench_document_free(document);
+  g_array_free(samples, TRUE);
+}
+
+static gint bench_compare_paths(gconstpointer a, gconstpointer b) {
+  return g_strcmp0(*(const gchar* const*)a, *(const gchar* const*)b);
+}
+
+/* directories are expanded to the files directly inside them */
+static void bench_collect(const char* path, GPtrArray* files) {
+  if (g_file_test(path, G_FILE_TEST_IS_DIR) == FALSE) {
+    g_ptr_array_add(files, g_strdup(path));
+    return;
+  }
+
+  GDir* dir = g_dir_open(path, 0, NULL);
+  if (dir == NULL) {
+    return;
+  }
+
+  GPtrArray* entries = g_ptr_array_new();
+  const gchar* name  = NULL;
+  while ((name = g_dir_read_name(dir)) != NULL) {
+    gchar* file = g_build_filename(path, name, NULL);
+    if (g_file_test(file, G_FILE_TEST_IS_REGULAR) == TRUE) {
+      g_ptr_array_add(entries, file);
+    } else {
+      g_free(file);
+    }
+  }
+  g_dir_close(dir);
+
+  /* a stable order keeps runs comparable */
+  g_ptr_array_sort(entries, bench_compare_paths);
+  for (guint i = 0; i < entries->len; i++) {
+    g_ptr_array_add(files, g_ptr_array_index(entries, i));
+  }
+  g_ptr_array_free(entries, TRUE);
+}
+
+int main(int argc, char* argv[]) {
+  GError* error           = NULL;
+  GOptionContext* context = g_option_context_new("FILE|DIRECTORY... - benchmark the mupdf plugin");
+  g_option_context_add_main_entries(context, option_entries, NULL);
+  if (g_option_context_parse(context, &argc, &argv, &error) == FALSE || argc < 2) {
+    g_printerr("%s\n", error != NULL ? error->message : "no corpus given");
+    g_clear_error(&error);
+    g_option_context_free(context);
+    return 1;
+  }
+  g_option_context_free(context);
+
+  if (preview_option < 1) {
+    g_printerr("invalid preview reduction %d\n", preview_option);
+    return 1;
+  }
+  if (thumbnail_option < 1) {
+    g_printerr("invalid thumbnail size %d\n", thumbnail_option);
+    return 1;
+  }
+
+  /* cached thumbnails would only measure reading them back */
+  g_setenv("ZATHURA_MUPDF_THUMBNAIL_CACHE", "0", TRUE);
+  /* prefetched pages would hide the cost of building their display lists */
+  g_setenv("ZATHURA_MUPDF_PREFETCH", "0", TRUE);
+  /* repeated renders of the same page and scale would only be copied from the raster cache */
+  g_setenv("ZATHURA_MUPDF_RASTER_CACHE", "0", TRUE);
+
+  gchar** scale_strings = g_strsplit(scales_option, ",", -1);
+  guint n_scales        = g_strv_length(scale_strings);
+  double* scales        = g_new0(double, n_scales);
+  for (guint i = 0; i < n_scales; i++) {
+    scales[i] = g_ascii_strtod(scale_strings[i], NULL);
+    if (scales[i] <= 0) {
+      g_printerr("invalid scale %s\n", scale_strings[i]);
+      return 1;
+    }
+  }
+  g_strfreev(scale_strings);
+
+  GPtrArray* files = g_ptr_array_new_with_free_func(g_free);
+  for (int i = 1; i < argc; i++) {
+    bench_collect(argv[i], files);
+  }
+
+  printf("{\n  \"files\": [\n");
+  for (guint i = 0; i < files->len; i++) {
+    bench_file(g_ptr_array_index(files, i), scales, n_scales, i == 0);
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("\n  ],\n  \"peak_rss_kb\": %ld\n}\n", usage.ru_maxrss);
+
+  g_ptr_array_free(files, TRUE);
+  g_free(scales);
+
+  return 0;
+}
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: Zlib */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <zathura/plugin-api.h>
+
+/**
+ * Creates a document the plugin can be opened on
+ *
+ * @param path Path of the file
+ * @return The document
+ */
+zathura_document_t* bench_document_new(const char* path);
+
+/**
+ * Frees a document created by bench_document_new
+ *
+ * @param document The document
+ */
+void bench_document_free(zathura_document_t* document);
+
+/**
+ * Returns the number of pages set by the plugin
+ *
+ * @param document The document
+ * @return Number of pages
+ */
+unsigned int bench_document_get_number_of_pages(zathura_document_t* document);
+
+/**
+ * Creates a page of a document
+ *
+ * @param document The document
+ * @param index Page number
+ * @return The page
+ */
+zathura_page_t* bench_page_new(zathura_document_t* document, unsigned int index);
+
+/**
+ * Frees a page created by bench_page_new
+ *
+ * @param page The page
+ */
+void bench_page_free(zathura_page_t* page);
+
+/**
+ * Returns the data set by the plugin
+ *
+ * @param page The page
+ * @return The plugin's page data
+ */
+void* bench_page_get_data(zathura_page_t* page);
+
+#endif // BENCH_H
@@ -0,0 +1,176 @@
+/* SPDX-License-Identifier: Zlib */
+
+#include <glib.h>
+
+#include "bench.h"
+
+/* The parts of zathura's plugin API the plugin calls, so that it runs without zathura */
+
+struct zathura_document_s {
+  char* path;
+  unsigned int number_of_pages;
+  GPtrArray* pages;
+  void* data;
+};
+
+struct zathura_page_s {
+  zathura_document_t* document;
+  unsigned int index;
+  double width;
+  double height;
+  void* data;
+};
+
+zathura_document_t* bench_document_new(const char* path) {
+  zathura_document_t* document = g_malloc0(sizeof(zathura_document_t));
+  document->path               = g_strdup(path);
+  document->pages              = g_ptr_array_new();
+
+  return document;
+}
+
+void bench_document_free(zathura_document_t* document) {
+  if (document == NULL) {
+    return;
+  }
+
+  g_ptr_array_free(document->pages, TRUE);
+  g_free(document->path);
+  g_free(document);
+}
+
+unsigned int bench_document_get_number_of_pages(zathura_document_t* document) {
+  return document->number_of_pages;
+}
+
+zathura_page_t* bench_page_new(zathura_document_t* document, unsigned int index) {
+  zathura_page_t* page = g_malloc0(sizeof(zathura_page_t));
+  page->document       = document;
+  page->index          = index;
+
+  if (document->pages->len <= index) {
+    g_ptr_array_set_size(document->pages, index + 1);
+  }
+  g_ptr_array_index(document->pages, index) = page;
+
+  return page;
+}
+
+void bench_page_free(zathura_page_t* page) {
+  if (page == NULL) {
+    return;
+  }
+
+  g_ptr_array_index(page->document->pages, page->index) = NULL;
+  g_free(page);
+}
+
+void* bench_page_get_data(zathura_page_t* page) {
+  return page->data;
+}
+
+const char* zathura_document_get_path(zathura_document_t* document) {
+  return document->path;
+}
+
+const char* zathura_document_get_password(zathura_document_t* GIRARA_UNUSED(document)) {
+  return NULL;
+}
+
+void zathura_document_set_number_of_pages(zathura_document_t* document, unsigned int number_of_pages) {
+  document->number_of_pages = number_of_pages;
+}
+
+void* zathura_document_get_data(zathura_document_t* document) {
+  return document->data;
+}
+
+void zathura_document_set_data(zathura_document_t* document, void* data) {
+  document->data = data;
+}
+
+zathura_page_t* zathura_document_get_page(zathura_document_t* document, unsigned int index) {
+  return index < document->pages->len ? g_ptr_array_index(document->pages, index) : NULL;
+}
+
+unsigned int zathura_document_get_number_of_pages(zathura_document_t* document) {
+  return document->number_of_pages;
+}
+
+zathura_document_t* zathura_page_get_document(zathura_page_t* page) {
+  return page->document;
+}
+
+unsigned int zathura_page_get_index(zathura_page_t* page) {
+  return page->index;
+}
+
+double zathura_page_get_width(zathura_page_t* page) {
+  return page->width;
+}
+
+void zathura_page_set_width(zathura_page_t* page, double width) {
+  page->width = width;
+}
+
+double zathura_page_get_height(zathura_page_t* page) {
+  return page->height;
+}
+
+void zathura_page_set_height(zathura_page_t* page, double height) {
+  page->height = height;
+}
+
+/* every page is rendered as if it was on screen */
+bool zathura_page_get_visibility(zathura_page_t* GIRARA_UNUSED(page)) {
+  return true;
+}
+
+void* zathura_page_get_data(zathura_page_t* page) {
+  return page->data;
+}
+
+void zathura_page_set_data(zathura_page_t* page, void* data) {
+  page->data = data;
+}
+
+/* links, the outline, document information and annotations are not benchmarked */
+
+zathura_link_t* zathura_link_new(zathura_link_type_t GIRARA_UNUSED(type), zathura_rectangle_t GIRARA_UNUSED(position),
+                                 zathura_link_target_t GIRARA_UNUSED(target)) {
+  return NULL;
+}
+
+void zathura_link_free(zathura_link_t* GIRARA_UNUSED(link)) {}
+
+zathura_index_element_t* zathura_index_element_new(const char* GIRARA_UNUSED(title)) {
+  return NULL;
+}
+
+void zathura_index_element_free(zathura_index_element_t* GIRARA_UNUSED(index)) {}
+
+girara_list_t* zathura_document_information_entry_list_new(void) {
+  return NULL;
+}
+
+zathura_document_information_entry_t*
+zathura_document_information_entry_new(zathura_document_information_type_t GIRARA_UNUSED(type),
+                                       const char* GIRARA_UNUSED(value)) {
+  return NULL;
+}
+
+zathura_highlight_t* zathura_highlight_new(unsigned int GIRARA_UNUSED(page), girara_list_t* GIRARA_UNUSED(rects),
+                                           zathura_highlight_color_t GIRARA_UNUSED(color),
+                                           const char* GIRARA_UNUSED(text)) {
+  return NULL;
+}
+
+void zathura_note_free(zathura_note_t* note) {
+  if (note == NULL) {
+    return;
+  }
+
+  g_free(note->id);
+  g_free(note->content);
+  g_free(note);
+}
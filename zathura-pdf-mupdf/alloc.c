@@ -0,0 +1,295 @@
+/* SPDX-License-Identifier: Zlib */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "alloc.h"
+
+/* every block is prefixed with its size; 16 bytes keep the alignment of malloc */
+#define MUPDF_ALLOC_HEADER 16
+
+/* small blocks come from size classes of 16 byte steps, carved out of aligned chunks */
+#define MUPDF_POOL_GRANULE 16
+#define MUPDF_POOL_CLASSES 32
+#define MUPDF_POOL_MAX (MUPDF_POOL_GRANULE * MUPDF_POOL_CLASSES)
+#define MUPDF_POOL_CHUNK (64 << 10)
+
+typedef struct mupdf_pool_block_s {
+  struct mupdf_pool_block_s* next;
+} mupdf_pool_block_t;
+
+typedef struct mupdf_pool_chunk_s {
+  struct mupdf_pool_chunk_s* prev; /**< Previous chunk of the class with free blocks */
+  struct mupdf_pool_chunk_s* next; /**< Next chunk of the class with free blocks */
+  mupdf_pool_block_t* free;        /**< Free blocks of the chunk */
+  unsigned int used;               /**< Number of blocks handed out */
+  unsigned int size_class;         /**< Class of the blocks */
+} mupdf_pool_chunk_t;
+
+typedef struct mupdf_pool_class_s {
+  GMutex mutex;                /**< Guards the class and its chunks */
+  mupdf_pool_chunk_t* partial; /**< Chunks with free blocks */
+  size_t chunks;               /**< Number of chunks */
+  size_t used;                 /**< Number of blocks handed out */
+} mupdf_pool_class_t;
+
+/* the chunk header is padded so that the blocks behind it stay aligned */
+#define MUPDF_POOL_CHUNK_HEADER                                                                                        \
+  ((sizeof(mupdf_pool_chunk_t) + MUPDF_ALLOC_HEADER - 1) / MUPDF_ALLOC_HEADER * MUPDF_ALLOC_HEADER)
+
+static volatile gssize mupdf_alloc_total = 0;
+static _Thread_local ptrdiff_t mupdf_alloc_balance = 0;
+
+static mupdf_pool_class_t mupdf_pool_classes[MUPDF_POOL_CLASSES];
+static bool mupdf_pool_enabled = false;
+
+static void mupdf_alloc_account(ptrdiff_t delta) {
+  mupdf_alloc_balance += delta;
+  g_atomic_pointer_add(&mupdf_alloc_total, delta);
+}
+
+/* reads ZATHURA_MUPDF_POOL once, the choice has to stay fixed while blocks exist */
+static bool mupdf_pool_is_enabled(void) {
+  static gsize initialized = 0;
+  if (g_once_init_enter(&initialized)) {
+    const char* value  = g_getenv("ZATHURA_MUPDF_POOL");
+    mupdf_pool_enabled = value == NULL || g_strcmp0(value, "0") != 0;
+    g_once_init_leave(&initialized, 1);
+  }
+
+  return mupdf_pool_enabled;
+}
+
+static unsigned int mupdf_pool_class(size_t size) {
+  return size == 0 ? 0 : (size - 1) / MUPDF_POOL_GRANULE;
+}
+
+static size_t mupdf_pool_block_size(unsigned int size_class) {
+  return MUPDF_ALLOC_HEADER + (size_t)(size_class + 1) * MUPDF_POOL_GRANULE;
+}
+
+static bool mupdf_pool_contains(size_t size) {
+  return size <= MUPDF_POOL_MAX && mupdf_pool_is_enabled() == true;
+}
+
+static mupdf_pool_chunk_t* mupdf_pool_chunk_of(void* block) {
+  return (mupdf_pool_chunk_t*)((uintptr_t)block & ~(uintptr_t)(MUPDF_POOL_CHUNK - 1));
+}
+
+static void mupdf_pool_link(mupdf_pool_class_t* pool_class, mupdf_pool_chunk_t* chunk) {
+  chunk->prev = NULL;
+  chunk->next = pool_class->partial;
+  if (pool_class->partial != NULL) {
+    pool_class->partial->prev = chunk;
+  }
+  pool_class->partial = chunk;
+}
+
+static void mupdf_pool_unlink(mupdf_pool_class_t* pool_class, mupdf_pool_chunk_t* chunk) {
+  if (chunk->prev != NULL) {
+    chunk->prev->next = chunk->next;
+  } else {
+    pool_class->partial = chunk->next;
+  }
+  if (chunk->next != NULL) {
+    chunk->next->prev = chunk->prev;
+  }
+}
+
+static mupdf_pool_chunk_t* mupdf_pool_chunk_new(unsigned int size_class) {
+  mupdf_pool_chunk_t* chunk = aligned_alloc(MUPDF_POOL_CHUNK, MUPDF_POOL_CHUNK);
+  if (chunk == NULL) {
+    return NULL;
+  }
+
+  chunk->free       = NULL;
+  chunk->used       = 0;
+  chunk->size_class = size_class;
+
+  /* the blocks are threaded in address order, so that consecutive allocations are adjacent */
+  const size_t block_size = mupdf_pool_block_size(size_class);
+  const size_t blocks     = (MUPDF_POOL_CHUNK - MUPDF_POOL_CHUNK_HEADER) / block_size;
+  for (size_t i = blocks; i > 0; i--) {
+    mupdf_pool_block_t* block = (mupdf_pool_block_t*)((unsigned char*)chunk + MUPDF_POOL_CHUNK_HEADER +
+                                                      (i - 1) * block_size);
+    block->next               = chunk->free;
+    chunk->free               = block;
+  }
+
+  return chunk;
+}
+
+static void* mupdf_pool_alloc(size_t size) {
+  const unsigned int size_class  = mupdf_pool_class(size);
+  mupdf_pool_class_t* pool_class = &mupdf_pool_classes[size_class];
+
+  g_mutex_lock(&pool_class->mutex);
+  mupdf_pool_chunk_t* chunk = pool_class->partial;
+  if (chunk == NULL) {
+    chunk = mupdf_pool_chunk_new(size_class);
+    if (chunk == NULL) {
+      g_mutex_unlock(&pool_class->mutex);
+      return NULL;
+    }
+    mupdf_pool_link(pool_class, chunk);
+    pool_class->chunks++;
+  }
+
+  mupdf_pool_block_t* block = chunk->free;
+  chunk->free               = block->next;
+  chunk->used++;
+  pool_class->used++;
+  if (chunk->free == NULL) {
+    mupdf_pool_unlink(pool_class, chunk);
+  }
+  g_mutex_unlock(&pool_class->mutex);
+
+  return block;
+}
+
+static void mupdf_pool_free(void* block) {
+  mupdf_pool_chunk_t* chunk      = mupdf_pool_chunk_of(block);
+  mupdf_pool_class_t* pool_class = &mupdf_pool_classes[chunk->size_class];
+
+  g_mutex_lock(&pool_class->mutex);
+  const bool was_full = chunk->free == NULL;
+
+  mupdf_pool_block_t* free_block = block;
+  free_block->next               = chunk->free;
+  chunk->free                    = free_block;
+  chunk->used--;
+  pool_class->used--;
+
+  if (was_full == true) {
+    mupdf_pool_link(pool_class, chunk);
+  }
+
+  /* empty chunks go back to the system as long as another chunk of the class has room */
+  if (chunk->used == 0 && (chunk->prev != NULL || chunk->next != NULL)) {
+    mupdf_pool_unlink(pool_class, chunk);
+    pool_class->chunks--;
+    free(chunk);
+  }
+  g_mutex_unlock(&pool_class->mutex);
+}
+
+/* allocates a block with its header, from the pools for small sizes */
+static unsigned char* mupdf_alloc_block(size_t size) {
+  if (mupdf_pool_contains(size) == true) {
+    return mupdf_pool_alloc(size);
+  }
+
+  return malloc(size + MUPDF_ALLOC_HEADER);
+}
+
+static void mupdf_alloc_free_block(unsigned char* block, size_t size) {
+  if (mupdf_pool_contains(size) == true) {
+    mupdf_pool_free(block);
+  } else {
+    free(block);
+  }
+}
+
+static void* mupdf_alloc_malloc(void* user, size_t size) {
+  (void)user;
+
+  if (size > SIZE_MAX - MUPDF_ALLOC_HEADER) {
+    return NULL;
+  }
+
+  unsigned char* block = mupdf_alloc_block(size);
+  if (block == NULL) {
+    return NULL;
+  }
+
+  *(size_t*)block = size;
+  mupdf_alloc_account(size);
+
+  return block + MUPDF_ALLOC_HEADER;
+}
+
+static void mupdf_alloc_free(void* user, void* ptr) {
+  (void)user;
+
+  if (ptr == NULL) {
+    return;
+  }
+
+  unsigned char* block = (unsigned char*)ptr - MUPDF_ALLOC_HEADER;
+  size_t size          = *(size_t*)block;
+
+  mupdf_alloc_account(-(ptrdiff_t)size);
+  mupdf_alloc_free_block(block, size);
+}
+
+static void* mupdf_alloc_realloc(void* user, void* ptr, size_t size) {
+  if (ptr == NULL) {
+    return mupdf_alloc_malloc(user, size);
+  }
+  if (size == 0) {
+    mupdf_alloc_free(user, ptr);
+    return NULL;
+  }
+  if (size > SIZE_MAX - MUPDF_ALLOC_HEADER) {
+    return NULL;
+  }
+
+  unsigned char* block = (unsigned char*)ptr - MUPDF_ALLOC_HEADER;
+  size_t old_size      = *(size_t*)block;
+
+  const bool old_pooled = mupdf_pool_contains(old_size);
+  const bool new_pooled = mupdf_pool_contains(size);
+  if (old_pooled == false && new_pooled == false) {
+    block = realloc(block, size + MUPDF_ALLOC_HEADER);
+    if (block == NULL) {
+      return NULL;
+    }
+  } else if (old_pooled == false || new_pooled == false ||
+             mupdf_pool_class(old_size) != mupdf_pool_class(size)) {
+    /* blocks moving between the pools and malloc are copied */
+    unsigned char* new_block = mupdf_alloc_block(size);
+    if (new_block == NULL) {
+      return NULL;
+    }
+    memcpy(new_block + MUPDF_ALLOC_HEADER, ptr, MIN(old_size, size));
+    mupdf_alloc_free_block(block, old_size);
+    block = new_block;
+  }
+
+  *(size_t*)block = size;
+  mupdf_alloc_account((ptrdiff_t)size - (ptrdiff_t)old_size);
+
+  return block + MUPDF_ALLOC_HEADER;
+}
+
+const fz_alloc_context mupdf_alloc_context = {
+    .user    = NULL,
+    .malloc  = mupdf_alloc_malloc,
+    .realloc = mupdf_alloc_realloc,
+    .free    = mupdf_alloc_free,
+};
+
+ptrdiff_t mupdf_alloc_thread_balance(void) {
+  return mupdf_alloc_balance;
+}
+
+size_t mupdf_alloc_in_use(void) {
+  gssize total = (gssize)g_atomic_pointer_get(&mupdf_alloc_total);
+  return total > 0 ? (size_t)total : 0;
+}
+
+void mupdf_alloc_pool_stats(size_t* reserved, size_t* used) {
+  *reserved = 0;
+  *used     = 0;
+
+  for (unsigned int i = 0; i < MUPDF_POOL_CLASSES; i++) {
+    mupdf_pool_class_t* pool_class = &mupdf_pool_classes[i];
+    g_mutex_lock(&pool_class->mutex);
+    *reserved += pool_class->chunks * MUPDF_POOL_CHUNK;
+    *used += pool_class->used * mupdf_pool_block_size(i);
+    g_mutex_unlock(&pool_class->mutex);
+  }
+}
@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: Zlib */
+
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include <mupdf/fitz.h>
+
+/**
+ * Allocator for mupdf contexts that accounts every allocation. The accounting
+ * is used to estimate the size of cached resources.
+ */
+extern const fz_alloc_context mupdf_alloc_context;
+
+/**
+ * Returns the bytes allocated minus the bytes freed by the calling thread.
+ * The difference of two calls estimates the memory retained by the work done
+ * in between.
+ *
+ * @return Allocation balance of the calling thread
+ */
+ptrdiff_t mupdf_alloc_thread_balance(void);
+
+/**
+ * Returns the bytes currently allocated through mupdf_alloc_context
+ *
+ * @return Allocated bytes
+ */
+size_t mupdf_alloc_in_use(void);
+
+/**
+ * Returns the memory held by the pools of small blocks. Blocks of up to 512
+ * bytes are taken from per size class chunks, which keeps the many small
+ * allocations of page interpretation apart from large buffers. Pooling can
+ * be disabled by setting ZATHURA_MUPDF_POOL to 0.
+ *
+ * @param reserved Set to the bytes of all chunks
+ * @param used Set to the bytes of the blocks handed out, headers included
+ */
+void mupdf_alloc_pool_stats(size_t* reserved, size_t* used);
+
+#endif // ALLOC_H
@@ -11,7 +11,7 @@
 typedef struct {
   girara_list_t* rects;
   zathura_highlight_color_t color;
-  fz_rect annot_rect;
+  GArray* areas;  /* Quads of the annotation as fz_rect, the text under them is copied */
 } annot_data_t;
 
 static void annot_data_free(annot_data_t* data) {
@@ -19,6 +19,9 @@ static void annot_data_free(annot_data_t* data) {
     if (data->rects != NULL) {
       girara_list_free(data->rects);
     }
+    if (data->areas != NULL) {
+      g_array_free(data->areas, TRUE);
+    }
     g_free(data);
   }
 }
@@ -60,7 +63,7 @@ girara_list_t* pdf_page_get_annotations(zathura_page_t* page, void* data,
   mupdf_page_t* mupdf_page = data;
   zathura_document_t* document = zathura_page_get_document(page);
 
-  if (document == NULL || mupdf_page->page == NULL) {
+  if (document == NULL) {
     if (error != NULL) {
       *error = ZATHURA_ERROR_INVALID_ARGUMENTS;
     }
@@ -84,15 +87,29 @@ girara_list_t* pdf_page_get_annotations(zathura_page_t* page, void* data,
     return NULL;
   }
 
-  g_mutex_lock(&mupdf_document->mutex);
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    girara_list_free(list);
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_UNKNOWN;
+    }
+    return NULL;
+  }
+
+  /* The page mutex guards the text, the document mutex the annotations */
+  g_mutex_lock(&mupdf_page->mutex);
 
-  fz_context* ctx = mupdf_document->ctx;
+  /* Extract text from page if not already extracted, highlights are still listed without it */
+  mupdf_text_lines_t* text_lines = mupdf_page_get_text_lines(mupdf_document, mupdf_page);
+
+  mupdf_document_lock(mupdf_document);
 
   /* Get pdf_page from fz_page */
-  pdf_page* ppage = pdf_page_from_fz_page(ctx, mupdf_page->page);
+  pdf_page* ppage = pdf_page_from_fz_page(ctx, mupdf_page_get_page(mupdf_document, mupdf_page, ctx));
   if (ppage == NULL) {
     g_debug("pdf_page_from_fz_page returned NULL");
-    g_mutex_unlock(&mupdf_document->mutex);
+    mupdf_document_unlock(mupdf_document);
+    g_mutex_unlock(&mupdf_page->mutex);
     girara_list_free(list);
     if (error != NULL) {
       *error = ZATHURA_ERROR_UNKNOWN;
@@ -106,15 +123,11 @@ girara_list_t* pdf_page_get_annotations(zathura_page_t* page, void* data,
 
   g_debug("Processing page %u (height: %f)", page_id, page_height);
 
-  /* Extract text from page if not already extracted */
-  if (mupdf_page->extracted_text == false) {
-    mupdf_page_extract_text(mupdf_document, mupdf_page);
-  }
-
   /* Create temporary list to hold annotation data */
   girara_list_t* annot_data_list = girara_list_new_with_free((girara_free_function_t)annot_data_free);
   if (annot_data_list == NULL) {
-    g_mutex_unlock(&mupdf_document->mutex);
+    mupdf_document_unlock(mupdf_document);
+    g_mutex_unlock(&mupdf_page->mutex);
     girara_list_free(list);
     if (error != NULL) {
       *error = ZATHURA_ERROR_OUT_OF_MEMORY;
@@ -150,8 +163,8 @@ girara_list_t* pdf_page_get_annotations(zathura_page_t* page, void* data,
         continue;
       }
 
-      /* Initialize bounding box from quad points */
-      fz_rect annot_rect = fz_empty_rect;
+      /* The quads whose text is copied */
+      GArray* areas = g_array_sized_new(FALSE, FALSE, sizeof(fz_rect), quad_count);
 
       /* Process each quad point */
       for (int i = 0; i < quad_count; i++) {
@@ -160,8 +173,7 @@ girara_list_t* pdf_page_get_annotations(zathura_page_t* page, void* data,
         /* Convert quad to rectangle - PDF coordinates to zathura coordinates */
         fz_rect r = fz_rect_from_quad(quad);
 
-        /* Expand bounding box to include this quad */
-        annot_rect = fz_union_rect(annot_rect, r);
+        g_array_append_val(areas, r);
 
         zathura_rectangle_t* rect = g_try_malloc0(sizeof(zathura_rectangle_t));
         if (rect == NULL) {
@@ -180,6 +192,7 @@ girara_list_t* pdf_page_get_annotations(zathura_page_t* page, void* data,
       /* Skip if no rectangles were created */
       if (girara_list_size(rects) == 0) {
         girara_list_free(rects);
+        g_array_free(areas, TRUE);
         continue;
       }
 
@@ -194,16 +207,18 @@ girara_list_t* pdf_page_get_annotations(zathura_page_t* page, void* data,
       if (data != NULL) {
         data->rects = rects;
         data->color = hl_color;
-        data->annot_rect = annot_rect;
+        data->areas = areas;
         girara_list_append(annot_data_list, data);
       } else {
         girara_list_free(rects);
+        g_array_free(areas, TRUE);
       }
     }
   }
   fz_catch(ctx) {
     g_debug("Exception caught during annotation processing");
-    g_mutex_unlock(&mupdf_document->mutex);
+    mupdf_document_unlock(mupdf_document);
+    g_mutex_unlock(&mupdf_page->mutex);
     girara_list_free(annot_data_list);
     girara_list_free(list);
     if (error != NULL) {
@@ -211,23 +226,21 @@ girara_list_t* pdf_page_get_annotations(zathura_page_t* page, void* data,
     }
     return NULL;
   }
+  mupdf_document_unlock(mupdf_document);
 
-  /* Phase 2: Extract text outside fz_try using page context (like select.c) */
+  /* Phase 2: Extract text outside fz_try and the document mutex (like select.c) */
   GIRARA_LIST_FOREACH_BODY(annot_data_list, annot_data_t*, data,
     char* text = NULL;
-    if (mupdf_page->text != NULL) {
-      fz_point a = {data->annot_rect.x0, data->annot_rect.y0};
-      fz_point b = {data->annot_rect.x1, data->annot_rect.y1};
-      text = fz_copy_selection(mupdf_page->ctx, mupdf_page->text, a, b, 0);
+    if (text_lines != NULL) {
+      /* only the lines around the quads are visited, not the whole page */
+      text = mupdf_text_lines_copy(text_lines, (const fz_rect*)data->areas->data, data->areas->len);
       if (text != NULL) {
         g_debug("Extracted text: %.50s%s", text, strlen(text) > 50 ? "..." : "");
       }
     }
 
     zathura_highlight_t* highlight = zathura_highlight_new(page_id, data->rects, data->color, text);
-    if (text != NULL) {
-      fz_free(mupdf_page->ctx, text);
-    }
+    g_free(text);
     if (highlight != NULL) {
       g_debug("Created highlight with %zu rectangles", girara_list_size(data->rects));
       girara_list_append(list, highlight);
@@ -238,7 +251,7 @@ girara_list_t* pdf_page_get_annotations(zathura_page_t* page, void* data,
 
   girara_list_free(annot_data_list);
   g_debug("Total annotations: %d, highlights: %d, returning %zu items", annot_count, highlight_count, girara_list_size(list));
-  g_mutex_unlock(&mupdf_document->mutex);
+  g_mutex_unlock(&mupdf_page->mutex);
 
   if (error != NULL) {
     *error = ZATHURA_ERROR_OK;
@@ -247,6 +260,49 @@ girara_list_t* pdf_page_get_annotations(zathura_page_t* page, void* data,
   return list;
 }
 
+/* Check if two rectangles match within tolerance */
+static bool rect_matches(zathura_rectangle_t* zr, double x0, double y0, double x1, double y1,
+                         double page_height, double eps) {
+  (void)page_height;  /* No longer needed */
+  /* Compare directly - coordinates are in the same space */
+  return (fabs(zr->x1 - x0) < eps && fabs(zr->x2 - x1) < eps &&
+          fabs(zr->y1 - y0) < eps && fabs(zr->y2 - y1) < eps);
+}
+
+/* Check if annotation geometry matches given rectangles */
+static bool annot_geometry_matches(fz_context* ctx, pdf_annot* annot,
+                                   girara_list_t* rects, double page_height) {
+  int quad_count = pdf_annot_quad_point_count(ctx, annot);
+  size_t rect_count = girara_list_size(rects);
+
+  if ((size_t)quad_count != rect_count) {
+    return false;
+  }
+
+  const double eps = ANNOTATION_MATCH_EPS;
+
+  for (int i = 0; i < quad_count; i++) {
+    fz_quad quad = pdf_annot_quad_point(ctx, annot, i);
+    fz_rect r = fz_rect_from_quad(quad);
+
+    zathura_rectangle_t* zr = girara_list_nth(rects, i);
+    if (zr == NULL || !rect_matches(zr, r.x0, r.y0, r.x1, r.y1, page_height, eps)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+typedef struct annot_match_s {
+  girara_list_t* rects;
+  double page_height;
+} annot_match_t;
+
+static bool annot_matches(fz_context* ctx, pdf_annot* annot, void* data) {
+  annot_match_t* match = data;
+  return annot_geometry_matches(ctx, annot, match->rects, match->page_height);
+}
+
 static void get_color_rgb(zathura_highlight_color_t color, float rgb[3]) {
   switch (color) {
     case ZATHURA_HIGHLIGHT_YELLOW:
@@ -266,155 +322,83 @@ static void get_color_rgb(zathura_highlight_color_t color, float rgb[3]) {
   }
 }
 
-zathura_error_t pdf_page_export_annotations(zathura_page_t* page, void* data,
-                                             girara_list_t* highlights) {
-  g_debug("pdf_page_export_annotations called");
-
-  if (page == NULL || data == NULL || highlights == NULL) {
-    return ZATHURA_ERROR_INVALID_ARGUMENTS;
-  }
-
-  mupdf_page_t* mupdf_page = data;
-  zathura_document_t* document = zathura_page_get_document(page);
-
-  if (document == NULL || mupdf_page->page == NULL) {
-    return ZATHURA_ERROR_INVALID_ARGUMENTS;
-  }
-
-  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
-  if (mupdf_document == NULL || mupdf_document->ctx == NULL) {
-    return ZATHURA_ERROR_INVALID_ARGUMENTS;
-  }
-
-  /* Get page height for coordinate conversion */
-  double page_height = zathura_page_get_height(page);
-  unsigned int page_id = zathura_page_get_index(page);
+/* creates a highlight annotation, its appearance is synthesized together with the page's other new annotations */
+static pdf_annot* highlight_create(fz_context* ctx, pdf_page* ppage, void* item) {
+  zathura_highlight_t* hl = item;
 
-  g_mutex_lock(&mupdf_document->mutex);
-
-  fz_context* ctx = mupdf_document->ctx;
-
-  /* Get pdf_page from fz_page */
-  pdf_page* ppage = pdf_page_from_fz_page(ctx, mupdf_page->page);
-  if (ppage == NULL) {
-    g_debug("pdf_page_from_fz_page returned NULL");
-    g_mutex_unlock(&mupdf_document->mutex);
-    return ZATHURA_ERROR_UNKNOWN;
+  girara_list_t* rects = hl->rects;
+  if (rects == NULL || girara_list_size(rects) == 0) {
+    g_debug("Highlight has no rectangles, skipping");
+    return NULL;
   }
 
-  g_debug("Exporting %zu highlights to page %u (height: %f)",
-          girara_list_size(highlights), page_id, page_height);
-
-  int exported = 0;
-  zathura_error_t result = ZATHURA_ERROR_OK;
+  /* Convert each rectangle to a quad point */
+  const size_t num_quads = girara_list_size(rects);
+  fz_quad* quads         = g_new(fz_quad, num_quads);
+  size_t quad_index      = 0;
+  GIRARA_LIST_FOREACH_BODY(rects, zathura_rectangle_t*, rect,
+    /* Map coordinates directly - no flipping needed */
+    quads[quad_index].ul.x = rect->x1;
+    quads[quad_index].ul.y = rect->y2;  /* upper-left (larger y in fz_quad) */
+    quads[quad_index].ur.x = rect->x2;
+    quads[quad_index].ur.y = rect->y2;  /* upper-right */
+    quads[quad_index].ll.x = rect->x1;
+    quads[quad_index].ll.y = rect->y1;  /* lower-left (smaller y) */
+    quads[quad_index].lr.x = rect->x2;
+    quads[quad_index].lr.y = rect->y1;  /* lower-right */
+    quad_index++;
+  );
 
+  pdf_annot* volatile annot = NULL;
   fz_try(ctx) {
-    /* Iterate through highlights and create PDF annotations */
-    GIRARA_LIST_FOREACH_BODY(highlights, zathura_highlight_t*, hl,
-      /* Only export highlights for this page */
-      if (hl->page != page_id) {
-        continue;
-      }
-
-      /* Convert zathura rectangles to PDF quad points */
-      girara_list_t* rects = hl->rects;
-      if (rects == NULL || girara_list_size(rects) == 0) {
-        g_debug("Highlight has no rectangles, skipping");
-        continue;
-      }
-
-      /* Allocate array for all quad points */
-      size_t num_quads = girara_list_size(rects);
-      fz_quad* quads = fz_malloc_array(ctx, num_quads, fz_quad);
-
-      /* Convert each rectangle to a quad point */
-      size_t quad_index = 0;
-      GIRARA_LIST_FOREACH_BODY(rects, zathura_rectangle_t*, rect,
-        /* Map coordinates directly - no flipping needed */
-        quads[quad_index].ul.x = rect->x1;
-        quads[quad_index].ul.y = rect->y2;  /* upper-left (larger y in fz_quad) */
-        quads[quad_index].ur.x = rect->x2;
-        quads[quad_index].ur.y = rect->y2;  /* upper-right */
-        quads[quad_index].ll.x = rect->x1;
-        quads[quad_index].ll.y = rect->y1;  /* lower-left (smaller y) */
-        quads[quad_index].lr.x = rect->x2;
-        quads[quad_index].lr.y = rect->y1;  /* lower-right */
-        quad_index++;
-      );
-
-      /* Create PDF highlight annotation */
-      pdf_annot* annot = pdf_create_annot(ctx, ppage, PDF_ANNOT_HIGHLIGHT);
-      if (annot == NULL) {
-        g_debug("Failed to create annotation");
-        fz_free(ctx, quads);
-        continue;
-      }
-
-      /* Set quad points for the annotation */
-      pdf_set_annot_quad_points(ctx, annot, num_quads, quads);
-
-      /* Free the quad array */
-      fz_free(ctx, quads);
-
-      /* Set annotation color */
-      float rgb[3];
-      get_color_rgb(hl->color, rgb);
-      pdf_set_annot_color(ctx, annot, 3, rgb);
-
-      /* Set text content if available */
-      if (hl->text != NULL && hl->text[0] != '\0') {
-        pdf_set_annot_contents(ctx, annot, hl->text);
-      }
+    annot = pdf_create_annot(ctx, ppage, PDF_ANNOT_HIGHLIGHT);
+    pdf_set_annot_quad_points(ctx, annot, num_quads, quads);
 
-      /* Update annotation appearance */
-      pdf_update_annot(ctx, annot);
+    float rgb[3];
+    get_color_rgb(hl->color, rgb);
+    pdf_set_annot_color(ctx, annot, 3, rgb);
 
-      exported++;
-      g_debug("Exported highlight %d with %zu rectangles", exported, num_quads);
-    );
+    if (hl->text != NULL && hl->text[0] != '\0') {
+      pdf_set_annot_contents(ctx, annot, hl->text);
+    }
+  }
+  fz_always(ctx) {
+    g_free(quads);
   }
   fz_catch(ctx) {
-    g_debug("Exception caught during annotation export");
-    result = ZATHURA_ERROR_UNKNOWN;
+    pdf_drop_annot(ctx, annot);
+    fz_rethrow(ctx);
   }
 
-  g_mutex_unlock(&mupdf_document->mutex);
-
-  g_debug("Exported %d highlights to page %u", exported, page_id);
-  return result;
-}
-
-/* Check if two rectangles match within tolerance */
-static bool rect_matches(zathura_rectangle_t* zr, double x0, double y0, double x1, double y1,
-                         double page_height, double eps) {
-  (void)page_height;  /* No longer needed */
-  /* Compare directly - coordinates are in the same space */
-  return (fabs(zr->x1 - x0) < eps && fabs(zr->x2 - x1) < eps &&
-          fabs(zr->y1 - y0) < eps && fabs(zr->y2 - y1) < eps);
+  return annot;
 }
 
-/* Check if annotation geometry matches given rectangles */
-static bool annot_geometry_matches(fz_context* ctx, pdf_annot* annot,
-                                   girara_list_t* rects, double page_height) {
-  int quad_count = pdf_annot_quad_point_count(ctx, annot);
-  size_t rect_count = girara_list_size(rects);
+zathura_error_t pdf_page_export_annotations(zathura_page_t* page, void* data,
+                                             girara_list_t* highlights) {
+  if (page == NULL || data == NULL || highlights == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
 
-  if ((size_t)quad_count != rect_count) {
-    return false;
+  zathura_document_t* document = zathura_page_get_document(page);
+  if (document == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
   }
 
-  const double eps = 1.0;
+  /* only the highlights of this page are exported, all of them in one operation */
+  const unsigned int page_id     = zathura_page_get_index(page);
+  mupdf_annotation_batch_t batch = {.page = data, .items = g_ptr_array_new(), .created = 0};
+  GIRARA_LIST_FOREACH_BODY(highlights, zathura_highlight_t*, hl,
+    if (hl->page == page_id) {
+      g_ptr_array_add(batch.items, hl);
+    }
+  );
 
-  for (int i = 0; i < quad_count; i++) {
-    fz_quad quad = pdf_annot_quad_point(ctx, annot, i);
-    fz_rect r = fz_rect_from_quad(quad);
+  zathura_error_t result = mupdf_document_create_annotations(zathura_document_get_data(document), &batch, 1,
+                                                             "Export highlights", highlight_create);
+  g_debug("Exported %u highlights to page %u", batch.created, page_id);
+  g_ptr_array_free(batch.items, TRUE);
 
-    zathura_rectangle_t* zr = girara_list_nth(rects, i);
-    if (zr == NULL || !rect_matches(zr, r.x0, r.y0, r.x1, r.y1, page_height, eps)) {
-      return false;
-    }
-  }
-  return true;
+  return result;
 }
 
 zathura_error_t pdf_page_delete_annotation(zathura_page_t* page, void* data,
@@ -428,7 +412,7 @@ zathura_error_t pdf_page_delete_annotation(zathura_page_t* page, void* data,
   mupdf_page_t* mupdf_page = data;
   zathura_document_t* document = zathura_page_get_document(page);
 
-  if (document == NULL || mupdf_page->page == NULL) {
+  if (document == NULL) {
     return ZATHURA_ERROR_INVALID_ARGUMENTS;
   }
 
@@ -441,15 +425,18 @@ zathura_error_t pdf_page_delete_annotation(zathura_page_t* page, void* data,
   double page_height = zathura_page_get_height(page);
   unsigned int page_id = zathura_page_get_index(page);
 
-  g_mutex_lock(&mupdf_document->mutex);
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
 
-  fz_context* ctx = mupdf_document->ctx;
+  mupdf_document_lock(mupdf_document);
 
   /* Get pdf_page from fz_page */
-  pdf_page* ppage = pdf_page_from_fz_page(ctx, mupdf_page->page);
+  pdf_page* ppage = pdf_page_from_fz_page(ctx, mupdf_page_get_page(mupdf_document, mupdf_page, ctx));
   if (ppage == NULL) {
     g_debug("pdf_page_from_fz_page returned NULL");
-    g_mutex_unlock(&mupdf_document->mutex);
+    mupdf_document_unlock(mupdf_document);
     return ZATHURA_ERROR_UNKNOWN;
   }
 
@@ -459,28 +446,23 @@ zathura_error_t pdf_page_delete_annotation(zathura_page_t* page, void* data,
   bool found = false;
   zathura_error_t result = ZATHURA_ERROR_OK;
 
-  fz_try(ctx) {
-    /* Iterate through annotations to find matching one */
-    for (pdf_annot* annot = pdf_first_annot(ctx, ppage); annot != NULL; ) {
-      /* Filter for highlight, underline, and strikeout annotations */
-      enum pdf_annot_type type = pdf_annot_type(ctx, annot);
-      if (type != PDF_ANNOT_HIGHLIGHT &&
-          type != PDF_ANNOT_UNDERLINE &&
-          type != PDF_ANNOT_STRIKE_OUT) {
-        annot = pdf_next_annot(ctx, annot);
-        continue;
-      }
+  /* the markups are looked up by the corner of their quads, which lies within the tolerance of the rectangles */
+  fz_rect bounds = fz_empty_rect;
+  GIRARA_LIST_FOREACH_BODY(rects, zathura_rectangle_t*, rect,
+    bounds = fz_union_rect(bounds, fz_make_rect(rect->x1, rect->y1, rect->x2, rect->y2));
+  );
 
-      /* Check if geometry matches */
-      if (annot_geometry_matches(ctx, annot, rects, page_height)) {
-        g_debug("Found matching annotation, deleting");
-        /* Delete the annotation */
-        pdf_delete_annot(ctx, ppage, annot);
-        found = true;
-        break;
-      }
+  annot_match_t match = {.rects = rects, .page_height = page_height};
+  const unsigned int types = 1u << PDF_ANNOT_HIGHLIGHT | 1u << PDF_ANNOT_UNDERLINE | 1u << PDF_ANNOT_STRIKE_OUT;
 
-      annot = pdf_next_annot(ctx, annot);
+  fz_try(ctx) {
+    pdf_annot* annot = mupdf_page_find_annotation(mupdf_page, ctx, ppage, types, fz_make_point(bounds.x0, bounds.y0),
+                                                  annot_matches, &match);
+    if (annot != NULL) {
+      g_debug("Found matching annotation, deleting");
+      mupdf_page_unindex_annotation(mupdf_page, ctx, annot);
+      pdf_delete_annot(ctx, ppage, annot);
+      found = true;
     }
 
     if (!found) {
@@ -490,12 +472,14 @@ zathura_error_t pdf_page_delete_annotation(zathura_page_t* page, void* data,
   }
   fz_catch(ctx) {
     g_debug("Exception caught during annotation deletion");
+    mupdf_page_drop_annotation_index(mupdf_page);
     result = ZATHURA_ERROR_UNKNOWN;
   }
 
-  g_mutex_unlock(&mupdf_document->mutex);
+  mupdf_document_unlock(mupdf_document);
 
   if (found) {
+    mupdf_page_invalidate(mupdf_document, mupdf_page);
     g_debug("Successfully deleted annotation on page %u", page_id);
   }
 
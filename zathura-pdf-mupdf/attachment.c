@@ -2,6 +2,9 @@
 #include "utils.h"
 #include <mupdf/pdf.h>
 
+/* bytes copied at once when an attachment is saved */
+#define ATTACHMENT_CHUNK_SIZE (64 << 10)
+
 girara_list_t* pdf_document_attachments_get(zathura_document_t* document, void* data, zathura_error_t* error) {
   if (document == NULL || data == NULL) {
     if (error != NULL) {
@@ -11,6 +14,13 @@ girara_list_t* pdf_document_attachments_get(zathura_document_t* document, void*
   }
 
   mupdf_document_t* mupdf_document = data;
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_UNKNOWN;
+    }
+    goto error_ret;
+  }
 
   /* Setup attachment list */
   girara_list_t* list = girara_list_new_with_free((girara_free_function_t)g_free);
@@ -22,27 +32,16 @@ girara_list_t* pdf_document_attachments_get(zathura_document_t* document, void*
   }
 
   /* Extract attachments */
-  g_mutex_lock(&mupdf_document->mutex);
-  fz_try(mupdf_document->ctx) {
-    pdf_document* pdf_doc = pdf_specifics(mupdf_document->ctx, mupdf_document->document);
-    pdf_filespec_params fs_params;
-    int n_objects = pdf_xref_len(mupdf_document->ctx, pdf_doc);
-
-    for (int i = 1; i < n_objects; ++i) {
-      pdf_obj* obj = pdf_load_object(mupdf_document->ctx, pdf_doc, i);
-      if (pdf_is_embedded_file(mupdf_document->ctx, obj)) {
-        pdf_get_filespec_params(mupdf_document->ctx, obj, &fs_params);
-        girara_list_append(list, g_strdup(fs_params.filename));
-      }
-    }
-  }
-  fz_catch(mupdf_document->ctx) {
-    if (error != NULL) {
-      *error = ZATHURA_ERROR_UNKNOWN;
-    }
+  mupdf_document_lock(mupdf_document);
+  if (mupdf_document_index_attachments(mupdf_document, ctx) == false) {
+    mupdf_document_unlock(mupdf_document);
     goto error_free;
   }
-  g_mutex_unlock(&mupdf_document->mutex);
+
+  for (guint i = 0; i < mupdf_document->attachment_names->len; i++) {
+    girara_list_append(list, g_strdup(g_ptr_array_index(mupdf_document->attachment_names, i)));
+  }
+  mupdf_document_unlock(mupdf_document);
 
   return list;
 
@@ -63,32 +62,50 @@ error_ret:
 
 zathura_error_t pdf_document_attachment_save(zathura_document_t* document, void* data, const char* name,
                                              const char* file) {
-  if (document == NULL || data == NULL) {
+  if (document == NULL || data == NULL || name == NULL || file == NULL) {
     return ZATHURA_ERROR_INVALID_ARGUMENTS;
   }
   mupdf_document_t* mupdf_document = data;
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  mupdf_document_lock(mupdf_document);
+  if (mupdf_document_index_attachments(mupdf_document, ctx) == false) {
+    mupdf_document_unlock(mupdf_document);
+    return ZATHURA_ERROR_UNKNOWN;
+  }
 
-  g_mutex_lock(&mupdf_document->mutex);
-  fz_try(mupdf_document->ctx) {
-    pdf_document* pdf_doc = pdf_specifics(mupdf_document->ctx, mupdf_document->document);
-    pdf_filespec_params fs_params;
-    int n_objects = pdf_xref_len(mupdf_document->ctx, pdf_doc);
-
-    for (int i = 1; i < n_objects; ++i) {
-      pdf_obj* obj = pdf_load_object(mupdf_document->ctx, pdf_doc, i);
-      if (pdf_is_embedded_file(mupdf_document->ctx, obj)) {
-        pdf_get_filespec_params(mupdf_document->ctx, obj, &fs_params);
-        if (strcmp(fs_params.filename, name) != 0) {
-          continue;
-        }
-        fz_save_buffer(mupdf_document->ctx, pdf_load_embedded_file_contents(mupdf_document->ctx, obj), file);
-      }
+  pdf_obj* filespec = g_hash_table_lookup(mupdf_document->attachments, name);
+  if (filespec == NULL) {
+    mupdf_document_unlock(mupdf_document);
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  /* the file is copied in chunks, so that large attachments are never held in memory as a whole */
+  zathura_error_t error      = ZATHURA_ERROR_OK;
+  fz_stream* volatile stream = NULL;
+  fz_output* volatile output = NULL;
+  fz_try(ctx) {
+    stream = pdf_open_stream(ctx, pdf_embedded_file_stream(ctx, filespec));
+    output = fz_new_output_with_path(ctx, file, 0);
+
+    unsigned char chunk[ATTACHMENT_CHUNK_SIZE];
+    size_t length = 0;
+    while ((length = fz_read(ctx, stream, chunk, sizeof(chunk))) > 0) {
+      fz_write_data(ctx, output, chunk, length);
     }
+    fz_close_output(ctx, output);
   }
-  fz_catch(mupdf_document->ctx) {
-    return ZATHURA_ERROR_UNKNOWN;
+  fz_always(ctx) {
+    fz_drop_output(ctx, output);
+    fz_drop_stream(ctx, stream);
+  }
+  fz_catch(ctx) {
+    error = ZATHURA_ERROR_UNKNOWN;
   }
-  g_mutex_unlock(&mupdf_document->mutex);
+  mupdf_document_unlock(mupdf_document);
 
-  return ZATHURA_ERROR_OK;
+  return error;
 }
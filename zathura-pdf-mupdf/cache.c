@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: Zlib */
+
+#include "cache.h"
+
+void mupdf_cache_init(mupdf_cache_t* cache, size_t budget, mupdf_cache_evict_function_t evict) {
+  g_mutex_init(&cache->mutex);
+  g_queue_init(&cache->lru);
+  cache->budget    = budget;
+  cache->used      = 0;
+  cache->peak      = 0;
+  cache->hits      = 0;
+  cache->misses    = 0;
+  cache->evictions = 0;
+  cache->evict     = evict;
+}
+
+void mupdf_cache_clear(mupdf_cache_t* cache) {
+  g_mutex_clear(&cache->mutex);
+}
+
+void mupdf_cache_touch(mupdf_cache_t* cache, mupdf_cache_entry_t* entry) {
+  g_mutex_lock(&cache->mutex);
+  if (entry->cached == true) {
+    g_queue_unlink(&cache->lru, &entry->link);
+    g_queue_push_head_link(&cache->lru, &entry->link);
+  }
+  cache->hits++;
+  g_mutex_unlock(&cache->mutex);
+}
+
+void mupdf_cache_insert(mupdf_cache_t* cache, mupdf_cache_entry_t* entry, size_t size, void* data) {
+  g_mutex_lock(&cache->mutex);
+  cache->misses++;
+
+  entry->link.data = entry;
+  entry->size      = size;
+  entry->cached    = true;
+  g_queue_push_head_link(&cache->lru, &entry->link);
+  cache->used += size;
+
+  GList* link = g_queue_peek_tail_link(&cache->lru);
+  while (cache->used > cache->budget && link != NULL && link != &entry->link) {
+    GList* prev                 = link->prev;
+    mupdf_cache_entry_t* victim = link->data;
+
+    /* entries whose owner is busy are skipped and stay cached */
+    if (cache->evict(data, victim) == true) {
+      g_queue_unlink(&cache->lru, link);
+      victim->cached = false;
+      cache->used -= victim->size;
+      cache->evictions++;
+    }
+
+    link = prev;
+  }
+  cache->peak = MAX(cache->peak, cache->used);
+  g_mutex_unlock(&cache->mutex);
+}
+
+void mupdf_cache_remove(mupdf_cache_t* cache, mupdf_cache_entry_t* entry) {
+  g_mutex_lock(&cache->mutex);
+  if (entry->cached == true) {
+    g_queue_unlink(&cache->lru, &entry->link);
+    entry->cached = false;
+    cache->used -= entry->size;
+  }
+  g_mutex_unlock(&cache->mutex);
+}
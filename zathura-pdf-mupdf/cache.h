@@ -0,0 +1,88 @@
+/* SPDX-License-Identifier: Zlib */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <glib.h>
+
+typedef struct mupdf_cache_entry_s mupdf_cache_entry_t;
+
+/**
+ * Releases the resource behind an entry. Called with the cache mutex held, so
+ * implementations may only try-lock the owner of the entry.
+ *
+ * @param data Data passed to mupdf_cache_insert
+ * @param entry The least recently used entry
+ * @return true if the resource was released, false if its owner was busy
+ */
+typedef bool (*mupdf_cache_evict_function_t)(void* data, mupdf_cache_entry_t* entry);
+
+struct mupdf_cache_entry_s {
+  GList link;  /**< Position in the LRU queue */
+  size_t size; /**< Accounted size in bytes */
+  bool cached; /**< If the entry is part of a cache */
+};
+
+typedef struct mupdf_cache_s {
+  GMutex mutex;                       /**< Guards all fields */
+  GQueue lru;                         /**< Entries, most recently used first */
+  size_t budget;                      /**< Maximal accounted size in bytes */
+  size_t used;                        /**< Currently accounted size in bytes */
+  size_t peak;                        /**< Largest accounted size after an insert */
+  guint64 hits;                       /**< Lookups served by the cache */
+  guint64 misses;                     /**< Lookups that had to build the resource */
+  guint64 evictions;                  /**< Entries released to stay in budget */
+  mupdf_cache_evict_function_t evict; /**< Releases evicted entries */
+} mupdf_cache_t;
+
+/**
+ * Returns the structure embedding a cache entry
+ */
+#define mupdf_cache_entry_owner(entry, type, member) ((type*)((char*)(entry) - offsetof(type, member)))
+
+/**
+ * Initializes a cache
+ *
+ * @param cache The cache
+ * @param budget Maximal accounted size in bytes
+ * @param evict Function releasing evicted entries
+ */
+void mupdf_cache_init(mupdf_cache_t* cache, size_t budget, mupdf_cache_evict_function_t evict);
+
+/**
+ * Clears a cache. All entries have to be removed before.
+ *
+ * @param cache The cache
+ */
+void mupdf_cache_clear(mupdf_cache_t* cache);
+
+/**
+ * Marks an entry as recently used and counts a hit
+ *
+ * @param cache The cache
+ * @param entry The entry
+ */
+void mupdf_cache_touch(mupdf_cache_t* cache, mupdf_cache_entry_t* entry);
+
+/**
+ * Adds an entry, counts a miss and evicts least recently used entries until
+ * the cache fits its budget again. The new entry itself is never evicted.
+ *
+ * @param cache The cache
+ * @param entry The entry
+ * @param size Accounted size in bytes
+ * @param data Passed on to the evict function
+ */
+void mupdf_cache_insert(mupdf_cache_t* cache, mupdf_cache_entry_t* entry, size_t size, void* data);
+
+/**
+ * Removes an entry without calling the evict function
+ *
+ * @param cache The cache
+ * @param entry The entry
+ */
+void mupdf_cache_remove(mupdf_cache_t* cache, mupdf_cache_entry_t* entry);
+
+#endif // CACHE_H
@@ -0,0 +1,326 @@
+/* SPDX-License-Identifier: Zlib */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "convert.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CONVERT_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#define CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+/* cairo's RGB24 is a native endian 0xXXRRGGBB word, which is B, G, R, X in memory on the supported targets;
+ * X is set to 0xFF so that the surface is also valid as ARGB32 */
+
+/* x / 255 rounded, exact for x <= 255 * 255 */
+static inline unsigned int convert_div255(unsigned int x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+static void convert_gray(const unsigned char* src, unsigned char* dst, size_t x, size_t width) {
+  for (; x < width; x++) {
+    dst[4 * x + 0] = src[x];
+    dst[4 * x + 1] = src[x];
+    dst[4 * x + 2] = src[x];
+    dst[4 * x + 3] = 0xFF;
+  }
+}
+
+static void convert_rgb(const unsigned char* src, unsigned char* dst, size_t x, size_t width) {
+  for (; x < width; x++) {
+    dst[4 * x + 0] = src[3 * x + 2];
+    dst[4 * x + 1] = src[3 * x + 1];
+    dst[4 * x + 2] = src[3 * x + 0];
+    dst[4 * x + 3] = 0xFF;
+  }
+}
+
+/* premultiplied colors composited over white are c + 255 - a, saturated against broken samples with c > a */
+static void convert_rgba(const unsigned char* src, unsigned char* dst, size_t x, size_t width) {
+  for (; x < width; x++) {
+    const unsigned int white = 255 - src[4 * x + 3];
+    for (unsigned int c = 0; c < 3; c++) {
+      const unsigned int value = src[4 * x + 2 - c] + white;
+      dst[4 * x + c]           = value > 255 ? 255 : value;
+    }
+    dst[4 * x + 3] = 0xFF;
+  }
+}
+
+/* the same naive conversion mupdf uses without color management */
+static void convert_cmyk(const unsigned char* src, unsigned char* dst, size_t x, size_t width) {
+  for (; x < width; x++) {
+    const unsigned int k = 255 - src[4 * x + 3];
+    dst[4 * x + 0]       = convert_div255((255 - src[4 * x + 2]) * k);
+    dst[4 * x + 1]       = convert_div255((255 - src[4 * x + 1]) * k);
+    dst[4 * x + 2]       = convert_div255((255 - src[4 * x + 0]) * k);
+    dst[4 * x + 3]       = 0xFF;
+  }
+}
+
+static void convert_gray_scalar(const unsigned char* src, unsigned char* dst, size_t width) {
+  convert_gray(src, dst, 0, width);
+}
+
+static void convert_rgb_scalar(const unsigned char* src, unsigned char* dst, size_t width) {
+  convert_rgb(src, dst, 0, width);
+}
+
+static void convert_rgba_scalar(const unsigned char* src, unsigned char* dst, size_t width) {
+  convert_rgba(src, dst, 0, width);
+}
+
+static void convert_cmyk_scalar(const unsigned char* src, unsigned char* dst, size_t width) {
+  convert_cmyk(src, dst, 0, width);
+}
+
+#ifdef CONVERT_X86
+#define X -1
+
+__attribute__((target("ssse3"))) static void convert_gray_ssse3(const unsigned char* src, unsigned char* dst,
+                                                                size_t width) {
+  const __m128i opaque   = _mm_set1_epi32((int)0xFF000000);
+  const __m128i masks[4] = {
+      _mm_setr_epi8(0, 0, 0, X, 1, 1, 1, X, 2, 2, 2, X, 3, 3, 3, X),
+      _mm_setr_epi8(4, 4, 4, X, 5, 5, 5, X, 6, 6, 6, X, 7, 7, 7, X),
+      _mm_setr_epi8(8, 8, 8, X, 9, 9, 9, X, 10, 10, 10, X, 11, 11, 11, X),
+      _mm_setr_epi8(12, 12, 12, X, 13, 13, 13, X, 14, 14, 14, X, 15, 15, 15, X),
+  };
+
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const __m128i gray = _mm_loadu_si128((const __m128i*)(src + x));
+    for (unsigned int i = 0; i < 4; i++) {
+      _mm_storeu_si128((__m128i*)(dst + 4 * x + 16 * i), _mm_or_si128(_mm_shuffle_epi8(gray, masks[i]), opaque));
+    }
+  }
+
+  convert_gray(src, dst, x, width);
+}
+
+__attribute__((target("ssse3"))) static void convert_rgb_ssse3(const unsigned char* src, unsigned char* dst,
+                                                               size_t width) {
+  const __m128i opaque = _mm_set1_epi32((int)0xFF000000);
+  const __m128i mask   = _mm_setr_epi8(2, 1, 0, X, 5, 4, 3, X, 8, 7, 6, X, 11, 10, 9, X);
+
+  /* each load reads 16 bytes for 4 pixels, so the last pixels are left to the scalar loop */
+  size_t x = 0;
+  for (; x + 6 <= width; x += 4) {
+    const __m128i rgb = _mm_loadu_si128((const __m128i*)(src + 3 * x));
+    _mm_storeu_si128((__m128i*)(dst + 4 * x), _mm_or_si128(_mm_shuffle_epi8(rgb, mask), opaque));
+  }
+
+  convert_rgb(src, dst, x, width);
+}
+
+__attribute__((target("ssse3"))) static void convert_rgba_ssse3(const unsigned char* src, unsigned char* dst,
+                                                                size_t width) {
+  const __m128i opaque = _mm_set1_epi32((int)0xFF000000);
+  const __m128i bgra   = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+  const __m128i alpha  = _mm_setr_epi8(3, 3, 3, X, 7, 7, 7, X, 11, 11, 11, X, 15, 15, 15, X);
+
+  size_t x = 0;
+  for (; x + 4 <= width; x += 4) {
+    const __m128i rgba  = _mm_loadu_si128((const __m128i*)(src + 4 * x));
+    const __m128i white = _mm_shuffle_epi8(_mm_xor_si128(rgba, _mm_set1_epi8(X)), alpha);
+    const __m128i color = _mm_adds_epu8(_mm_shuffle_epi8(rgba, bgra), white);
+    _mm_storeu_si128((__m128i*)(dst + 4 * x), _mm_or_si128(color, opaque));
+  }
+
+  convert_rgba(src, dst, x, width);
+}
+
+__attribute__((target("ssse3"))) static inline __m128i convert_div255_ssse3(__m128i x) {
+  x = _mm_add_epi16(x, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("ssse3"))) static void convert_cmyk_ssse3(const unsigned char* src, unsigned char* dst,
+                                                                size_t width) {
+  const __m128i opaque = _mm_set1_epi32((int)0xFF000000);
+  /* the inverted Y, M and C of two pixels, and their K, widened to 16 bits */
+  const __m128i ymc_lo = _mm_setr_epi8(2, X, 1, X, 0, X, X, X, 6, X, 5, X, 4, X, X, X);
+  const __m128i ymc_hi = _mm_setr_epi8(10, X, 9, X, 8, X, X, X, 14, X, 13, X, 12, X, X, X);
+  const __m128i k_lo   = _mm_setr_epi8(3, X, 3, X, 3, X, X, X, 7, X, 7, X, 7, X, X, X);
+  const __m128i k_hi   = _mm_setr_epi8(11, X, 11, X, 11, X, X, X, 15, X, 15, X, 15, X, X, X);
+
+  size_t x = 0;
+  for (; x + 4 <= width; x += 4) {
+    const __m128i cmyk = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + 4 * x)), _mm_set1_epi8(X));
+    const __m128i lo   = _mm_mullo_epi16(_mm_shuffle_epi8(cmyk, ymc_lo), _mm_shuffle_epi8(cmyk, k_lo));
+    const __m128i hi   = _mm_mullo_epi16(_mm_shuffle_epi8(cmyk, ymc_hi), _mm_shuffle_epi8(cmyk, k_hi));
+    const __m128i bgrx = _mm_packus_epi16(convert_div255_ssse3(lo), convert_div255_ssse3(hi));
+    _mm_storeu_si128((__m128i*)(dst + 4 * x), _mm_or_si128(bgrx, opaque));
+  }
+
+  convert_cmyk(src, dst, x, width);
+}
+
+/* AVX2 shuffles work within 128 bit lanes, which suits the formats with whole pixels per lane */
+
+__attribute__((target("avx2"))) static void convert_gray_avx2(const unsigned char* src, unsigned char* dst,
+                                                              size_t width) {
+  const __m256i opaque   = _mm256_set1_epi32((int)0xFF000000);
+  const __m256i masks[2] = {
+      _mm256_setr_epi8(0, 0, 0, X, 1, 1, 1, X, 2, 2, 2, X, 3, 3, 3, X, 4, 4, 4, X, 5, 5, 5, X, 6, 6, 6, X, 7, 7, 7,
+                       X),
+      _mm256_setr_epi8(8, 8, 8, X, 9, 9, 9, X, 10, 10, 10, X, 11, 11, 11, X, 12, 12, 12, X, 13, 13, 13, X, 14, 14,
+                       14, X, 15, 15, 15, X),
+  };
+
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const __m256i gray = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(src + x)));
+    for (unsigned int i = 0; i < 2; i++) {
+      _mm256_storeu_si256((__m256i*)(dst + 4 * x + 32 * i),
+                          _mm256_or_si256(_mm256_shuffle_epi8(gray, masks[i]), opaque));
+    }
+  }
+
+  convert_gray(src, dst, x, width);
+}
+
+__attribute__((target("avx2"))) static void convert_rgba_avx2(const unsigned char* src, unsigned char* dst,
+                                                              size_t width) {
+  const __m256i opaque = _mm256_set1_epi32((int)0xFF000000);
+  const __m256i bgra   = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15, 2, 1, 0, 3, 6, 5, 4,
+                                          7, 10, 9, 8, 11, 14, 13, 12, 15);
+  const __m256i alpha  = _mm256_setr_epi8(3, 3, 3, X, 7, 7, 7, X, 11, 11, 11, X, 15, 15, 15, X, 3, 3, 3, X, 7, 7, 7,
+                                          X, 11, 11, 11, X, 15, 15, 15, X);
+
+  size_t x = 0;
+  for (; x + 8 <= width; x += 8) {
+    const __m256i rgba  = _mm256_loadu_si256((const __m256i*)(src + 4 * x));
+    const __m256i white = _mm256_shuffle_epi8(_mm256_xor_si256(rgba, _mm256_set1_epi8(X)), alpha);
+    const __m256i color = _mm256_adds_epu8(_mm256_shuffle_epi8(rgba, bgra), white);
+    _mm256_storeu_si256((__m256i*)(dst + 4 * x), _mm256_or_si256(color, opaque));
+  }
+
+  convert_rgba(src, dst, x, width);
+}
+
+#undef X
+#endif
+
+#ifdef CONVERT_NEON
+static void convert_gray_neon(const unsigned char* src, unsigned char* dst, size_t width) {
+  uint8x16x4_t bgrx;
+  bgrx.val[3] = vdupq_n_u8(0xFF);
+
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const uint8x16_t gray = vld1q_u8(src + x);
+    bgrx.val[0]           = gray;
+    bgrx.val[1]           = gray;
+    bgrx.val[2]           = gray;
+    vst4q_u8(dst + 4 * x, bgrx);
+  }
+
+  convert_gray(src, dst, x, width);
+}
+
+static void convert_rgb_neon(const unsigned char* src, unsigned char* dst, size_t width) {
+  uint8x16x4_t bgrx;
+  bgrx.val[3] = vdupq_n_u8(0xFF);
+
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const uint8x16x3_t rgb = vld3q_u8(src + 3 * x);
+    bgrx.val[0]            = rgb.val[2];
+    bgrx.val[1]            = rgb.val[1];
+    bgrx.val[2]            = rgb.val[0];
+    vst4q_u8(dst + 4 * x, bgrx);
+  }
+
+  convert_rgb(src, dst, x, width);
+}
+
+static void convert_rgba_neon(const unsigned char* src, unsigned char* dst, size_t width) {
+  uint8x16x4_t bgrx;
+  bgrx.val[3] = vdupq_n_u8(0xFF);
+
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const uint8x16x4_t rgba = vld4q_u8(src + 4 * x);
+    const uint8x16_t white  = vmvnq_u8(rgba.val[3]);
+    bgrx.val[0]             = vqaddq_u8(rgba.val[2], white);
+    bgrx.val[1]             = vqaddq_u8(rgba.val[1], white);
+    bgrx.val[2]             = vqaddq_u8(rgba.val[0], white);
+    vst4q_u8(dst + 4 * x, bgrx);
+  }
+
+  convert_rgba(src, dst, x, width);
+}
+
+static inline uint8x16_t convert_multiply_neon(uint8x16_t a, uint8x16_t b) {
+  const uint16x8_t lo = vmull_u8(vget_low_u8(a), vget_low_u8(b));
+  const uint16x8_t hi = vmull_u8(vget_high_u8(a), vget_high_u8(b));
+
+  /* (x + 128 + ((x + 128) >> 8)) >> 8 */
+  return vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)), vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+}
+
+static void convert_cmyk_neon(const unsigned char* src, unsigned char* dst, size_t width) {
+  uint8x16x4_t bgrx;
+  bgrx.val[3] = vdupq_n_u8(0xFF);
+
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const uint8x16x4_t cmyk = vld4q_u8(src + 4 * x);
+    const uint8x16_t k      = vmvnq_u8(cmyk.val[3]);
+    bgrx.val[0]             = convert_multiply_neon(vmvnq_u8(cmyk.val[2]), k);
+    bgrx.val[1]             = convert_multiply_neon(vmvnq_u8(cmyk.val[1]), k);
+    bgrx.val[2]             = convert_multiply_neon(vmvnq_u8(cmyk.val[0]), k);
+    vst4q_u8(dst + 4 * x, bgrx);
+  }
+
+  convert_cmyk(src, dst, x, width);
+}
+#endif
+
+mupdf_convert_row_t mupdf_convert_get_row(mupdf_convert_format_t format) {
+#if defined(CONVERT_X86)
+  const bool avx2  = __builtin_cpu_supports("avx2");
+  const bool ssse3 = __builtin_cpu_supports("ssse3");
+
+  switch (format) {
+    case MUPDF_CONVERT_GRAY:
+      return avx2 == true ? convert_gray_avx2 : ssse3 == true ? convert_gray_ssse3 : convert_gray_scalar;
+    case MUPDF_CONVERT_RGB:
+      return ssse3 == true ? convert_rgb_ssse3 : convert_rgb_scalar;
+    case MUPDF_CONVERT_RGBA:
+      return avx2 == true ? convert_rgba_avx2 : ssse3 == true ? convert_rgba_ssse3 : convert_rgba_scalar;
+    case MUPDF_CONVERT_CMYK:
+      return ssse3 == true ? convert_cmyk_ssse3 : convert_cmyk_scalar;
+  }
+#elif defined(CONVERT_NEON)
+  switch (format) {
+    case MUPDF_CONVERT_GRAY:
+      return convert_gray_neon;
+    case MUPDF_CONVERT_RGB:
+      return convert_rgb_neon;
+    case MUPDF_CONVERT_RGBA:
+      return convert_rgba_neon;
+    case MUPDF_CONVERT_CMYK:
+      return convert_cmyk_neon;
+  }
+#endif
+
+  switch (format) {
+    case MUPDF_CONVERT_GRAY:
+      return convert_gray_scalar;
+    case MUPDF_CONVERT_RGB:
+      return convert_rgb_scalar;
+    case MUPDF_CONVERT_RGBA:
+      return convert_rgba_scalar;
+    case MUPDF_CONVERT_CMYK:
+      break;
+  }
+
+  return convert_cmyk_scalar;
+}
@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: Zlib */
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stddef.h>
+
+typedef enum mupdf_convert_format_e {
+  MUPDF_CONVERT_GRAY, /**< One gray or mask byte per pixel */
+  MUPDF_CONVERT_RGB,  /**< Three bytes per pixel */
+  MUPDF_CONVERT_RGBA, /**< Three bytes and premultiplied alpha per pixel */
+  MUPDF_CONVERT_CMYK, /**< Four bytes per pixel */
+} mupdf_convert_format_t;
+
+/**
+ * Converts a row of pixels to cairo's CAIRO_FORMAT_RGB24 layout. Pixels with
+ * alpha are composited over white.
+ *
+ * @param src The source pixels
+ * @param dst The destination, 4 bytes per pixel
+ * @param width Number of pixels
+ */
+typedef void (*mupdf_convert_row_t)(const unsigned char* src, unsigned char* dst, size_t width);
+
+/**
+ * Returns the fastest row converter for a format the running CPU supports
+ *
+ * @param format The source format
+ * @return The converter
+ */
+mupdf_convert_row_t mupdf_convert_get_row(mupdf_convert_format_t format);
+
+#endif // CONVERT_H
@@ -4,12 +4,141 @@
 #include <mupdf/pdf.h>
 
 #include <glib-2.0/glib.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "plugin.h"
+#include "alloc.h"
+#include "utils.h"
 #include <girara/utils.h>
 
 #define LENGTH(x) (sizeof(x) / sizeof((x)[0]))
 
+/* bounds of the memory budget derived from the physical memory, see ZATHURA_MUPDF_MEMORY */
+#define MEMORY_BUDGET_MIN ((size_t)128 << 20)
+#define MEMORY_BUDGET_MAX ((size_t)4 << 30)
+/* budget if the physical memory is unknown */
+#define MEMORY_BUDGET_DEFAULT ((size_t)512 << 20)
+/* default number of loaded pages, see ZATHURA_MUPDF_PAGE_CACHE */
+#define PAGE_CACHE_DEFAULT 64
+/* default minimum band height, see ZATHURA_MUPDF_BAND_HEIGHT */
+#define BAND_HEIGHT_DEFAULT 256
+/* default number of pages prepared ahead of the reading position, see ZATHURA_MUPDF_PREFETCH */
+#define PREFETCH_DEFAULT 0
+
+#if !defined(HAVE_ALL_FORMATS)
+/* the handlers of the formats, mupdf defines them without declaring them in its headers */
+#if defined(HAVE_PDF) && FZ_ENABLE_PDF
+extern fz_document_handler pdf_document_handler;
+#endif
+#if defined(HAVE_XPS) && FZ_ENABLE_XPS
+extern fz_document_handler xps_document_handler;
+#endif
+#if defined(HAVE_EPUB) && FZ_ENABLE_EPUB
+extern fz_document_handler epub_document_handler;
+#endif
+#if defined(HAVE_FB2) && FZ_ENABLE_HTML
+extern fz_document_handler fb2_document_handler;
+#endif
+#if defined(HAVE_MOBI) && FZ_ENABLE_HTML
+extern fz_document_handler mobi_document_handler;
+#endif
+#if defined(HAVE_SVG) && FZ_ENABLE_SVG
+extern fz_document_handler svg_document_handler;
+#endif
+#if defined(HAVE_IMAGE) && FZ_ENABLE_IMG
+extern fz_document_handler img_document_handler;
+#endif
+#endif
+
+/* only the formats the plugin was built for, registering every handler is a noticeable part of opening small files */
+static void pdf_document_register_handlers(fz_context* ctx) {
+#if defined(HAVE_ALL_FORMATS)
+  fz_register_document_handlers(ctx);
+#else
+#if defined(HAVE_PDF) && FZ_ENABLE_PDF
+  fz_register_document_handler(ctx, &pdf_document_handler);
+#endif
+#if defined(HAVE_XPS) && FZ_ENABLE_XPS
+  fz_register_document_handler(ctx, &xps_document_handler);
+#endif
+#if defined(HAVE_EPUB) && FZ_ENABLE_EPUB
+  fz_register_document_handler(ctx, &epub_document_handler);
+#endif
+#if defined(HAVE_FB2) && FZ_ENABLE_HTML
+  fz_register_document_handler(ctx, &fb2_document_handler);
+#endif
+#if defined(HAVE_MOBI) && FZ_ENABLE_HTML
+  fz_register_document_handler(ctx, &mobi_document_handler);
+#endif
+#if defined(HAVE_SVG) && FZ_ENABLE_SVG
+  fz_register_document_handler(ctx, &svg_document_handler);
+#endif
+#if defined(HAVE_IMAGE) && FZ_ENABLE_IMG
+  fz_register_document_handler(ctx, &img_document_handler);
+#endif
+#endif
+}
+
+/* a sixteenth of the physical memory unless configured, shared by mupdf's store and the plugin's caches */
+static size_t pdf_document_memory_budget(void) {
+  long pages     = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGESIZE);
+  size_t budget  = MEMORY_BUDGET_DEFAULT;
+  if (pages > 0 && page_size > 0) {
+    budget = CLAMP((size_t)pages / 16 * (size_t)page_size, MEMORY_BUDGET_MIN, MEMORY_BUDGET_MAX);
+  }
+
+  return mupdf_getenv_size("ZATHURA_MUPDF_MEMORY", budget);
+}
+
+static void pdf_document_lock(void* user, int lock) {
+  mupdf_document_t* mupdf_document = user;
+  g_mutex_lock(&mupdf_document->locks[lock]);
+}
+
+static void pdf_document_unlock(void* user, int lock) {
+  mupdf_document_t* mupdf_document = user;
+  g_mutex_unlock(&mupdf_document->locks[lock]);
+}
+
+/* opens the document on a read-only mapping of the file, so that objects are read straight from the page cache
+ * instead of through the buffered file stream; returns NULL if the file cannot be mapped */
+static fz_document* pdf_document_open_mapped(mupdf_document_t* mupdf_document, const char* path) {
+  fz_context* ctx     = mupdf_document->ctx;
+  GMappedFile* mapped = g_mapped_file_new(path, FALSE, NULL);
+  if (mapped == NULL) {
+    return NULL;
+  }
+
+  /* empty files have no mapping */
+  const unsigned char* contents = (const unsigned char*)g_mapped_file_get_contents(mapped);
+  if (contents == NULL) {
+    g_mapped_file_unref(mapped);
+    return NULL;
+  }
+
+  fz_stream* volatile stream      = NULL;
+  fz_document* volatile mupdf_doc = NULL;
+  fz_try(ctx) {
+    stream    = fz_open_memory(ctx, contents, g_mapped_file_get_length(mapped));
+    mupdf_doc = fz_open_document_with_stream(ctx, path, stream);
+  }
+  fz_always(ctx) {
+    /* the document keeps its own reference */
+    fz_drop_stream(ctx, stream);
+  }
+  fz_catch(ctx) {
+    g_mapped_file_unref(mapped);
+    fz_rethrow(ctx);
+  }
+
+  mupdf_document->mapped = mapped;
+
+  return mupdf_doc;
+}
+
 zathura_error_t pdf_document_open(zathura_document_t* document) {
   zathura_error_t error = ZATHURA_ERROR_OK;
   if (document == NULL) {
@@ -24,19 +153,57 @@ zathura_error_t pdf_document_open(zathura_document_t* document) {
   }
 
   g_mutex_init(&mupdf_document->mutex);
+  g_mutex_init(&mupdf_document->contexts_mutex);
+  for (unsigned int i = 0; i < LENGTH(mupdf_document->locks); i++) {
+    g_mutex_init(&mupdf_document->locks[i]);
+  }
+  mupdf_document->contexts = g_hash_table_new(g_direct_hash, g_direct_equal);
+  mupdf_stats_init(&mupdf_document->stats);
+  mupdf_cache_init(&mupdf_document->pages, mupdf_getenv_uint("ZATHURA_MUPDF_PAGE_CACHE", PAGE_CACHE_DEFAULT),
+                   mupdf_page_evict_page);
+  /* half of the budget goes to mupdf's fonts and images, the rest to display lists and texts */
+  mupdf_document->memory_budget = pdf_document_memory_budget();
+  mupdf_document->store_budget  = mupdf_getenv_size("ZATHURA_MUPDF_STORE", mupdf_document->memory_budget / 2);
+  mupdf_cache_init(&mupdf_document->display_lists,
+                   mupdf_getenv_size("ZATHURA_MUPDF_DISPLAY_LIST_CACHE", mupdf_document->memory_budget / 8 * 3),
+                   mupdf_page_evict_display_list);
+  mupdf_cache_init(&mupdf_document->texts,
+                   mupdf_getenv_size("ZATHURA_MUPDF_TEXT_CACHE", mupdf_document->memory_budget / 8),
+                   mupdf_page_evict_text);
+  mupdf_rasters_init(&mupdf_document->rasters, mupdf_getenv_size("ZATHURA_MUPDF_RASTER_CACHE", 0));
+  mupdf_document->tile_size        = mupdf_getenv_uint("ZATHURA_MUPDF_TILE_SIZE", 0);
+  mupdf_document->render_bands     = MIN(mupdf_getenv_uint("ZATHURA_MUPDF_RENDER_BANDS", g_get_num_processors()),
+                                         RENDER_BANDS_MAX);
+  mupdf_document->band_height      = mupdf_getenv_uint("ZATHURA_MUPDF_BAND_HEIGHT", BAND_HEIGHT_DEFAULT);
+  mupdf_document->outline_depth    = mupdf_getenv_uint("ZATHURA_MUPDF_OUTLINE_DEPTH", 0);
+  mupdf_document->thumbnail_cache  = mupdf_getenv_uint("ZATHURA_MUPDF_THUMBNAIL_CACHE", 0) != 0;
+  mupdf_document->incremental_save = mupdf_getenv_uint("ZATHURA_MUPDF_INCREMENTAL_SAVE", 1) != 0;
+  if (mupdf_getenv_uint("ZATHURA_MUPDF_RENDER_ABORT", 0) != 0) {
+    mupdf_document->watchdog = mupdf_watchdog_new();
+  }
 
-  mupdf_document->ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+  /* the locks allow worker threads to use their own clones of the context */
+  fz_locks_context locks_context = {
+      .user   = mupdf_document,
+      .lock   = pdf_document_lock,
+      .unlock = pdf_document_unlock,
+  };
+
+  mupdf_document->ctx = fz_new_context(&mupdf_alloc_context, &locks_context, mupdf_document->store_budget);
   if (mupdf_document->ctx == NULL) {
     error = ZATHURA_ERROR_UNKNOWN;
     goto error_free;
   }
 
+  /* the opening thread keeps using the base context */
+  mupdf_document_set_context(mupdf_document, mupdf_document->ctx);
+
   /* open document */
   const char* path     = zathura_document_get_path(document);
   const char* password = zathura_document_get_password(document);
 
   fz_try(mupdf_document->ctx) {
-    fz_register_document_handlers(mupdf_document->ctx);
+    pdf_document_register_handlers(mupdf_document->ctx);
 
     /* read user css from zathura/epub.css */
     char* xdg_path = girara_get_xdg_path(XDG_CONFIG);
@@ -51,11 +218,16 @@ zathura_error_t pdf_document_open(zathura_document_t* document) {
       g_free(xdg_path);
     }
 
-    mupdf_document->document = fz_open_document(mupdf_document->ctx, path);
+    if (mupdf_getenv_uint("ZATHURA_MUPDF_MMAP", 0) != 0) {
+      mupdf_document->document = pdf_document_open_mapped(mupdf_document, path);
+    }
+    if (mupdf_document->document == NULL) {
+      mupdf_document->document = fz_open_document(mupdf_document->ctx, path);
+    }
   }
   fz_catch(mupdf_document->ctx) {
     error = ZATHURA_ERROR_UNKNOWN;
-    return error;
+    goto error_free;
   }
 
   if (mupdf_document->document == NULL) {
@@ -74,18 +246,47 @@ zathura_error_t pdf_document_open(zathura_document_t* document) {
   zathura_document_set_number_of_pages(document, fz_count_pages(mupdf_document->ctx, mupdf_document->document));
   zathura_document_set_data(document, mupdf_document);
 
+  if (mupdf_getenv_uint("ZATHURA_MUPDF_TEXT_INDEX", 0) != 0) {
+    mupdf_document->text_index = mupdf_text_index_new(mupdf_document, path);
+  }
+
+  const unsigned int prefetch = mupdf_getenv_uint("ZATHURA_MUPDF_PREFETCH", PREFETCH_DEFAULT);
+  if (prefetch > 0) {
+    mupdf_document->prefetch =
+        mupdf_prefetch_new(mupdf_document, prefetch, mupdf_getenv_uint("ZATHURA_MUPDF_PREFETCH_TEXT", 0) != 0);
+  }
+
   return ZATHURA_ERROR_OK;
 
 error_free:
 
   if (mupdf_document != NULL) {
-    g_mutex_clear(&mupdf_document->mutex);
     if (mupdf_document->document != NULL) {
       fz_drop_document(mupdf_document->ctx, mupdf_document->document);
     }
+    mupdf_document_drop_contexts(mupdf_document);
     if (mupdf_document->ctx != NULL) {
       fz_drop_context(mupdf_document->ctx);
     }
+    if (mupdf_document->mapped != NULL) {
+      g_mapped_file_unref(mupdf_document->mapped);
+    }
+
+    mupdf_watchdog_free(mupdf_document->watchdog);
+    mupdf_rasters_clear(&mupdf_document->rasters);
+    mupdf_cache_clear(&mupdf_document->texts);
+    mupdf_cache_clear(&mupdf_document->display_lists);
+    mupdf_cache_clear(&mupdf_document->pages);
+    g_hash_table_unref(mupdf_document->contexts);
+    if (mupdf_document->destinations != NULL) {
+      g_hash_table_unref(mupdf_document->destinations);
+    }
+    for (unsigned int i = 0; i < LENGTH(mupdf_document->locks); i++) {
+      g_mutex_clear(&mupdf_document->locks[i]);
+    }
+    g_mutex_clear(&mupdf_document->contexts_mutex);
+    g_mutex_clear(&mupdf_document->mutex);
+    mupdf_stats_clear(&mupdf_document->stats);
 
     free(mupdf_document);
   }
@@ -104,13 +305,63 @@ zathura_error_t pdf_document_free(zathura_document_t* document, void* data) {
     return ZATHURA_ERROR_INVALID_ARGUMENTS;
   }
 
-  g_mutex_lock(&mupdf_document->mutex);
-
+  /* wait for the indexer, the prefetcher, outstanding bands and thumbnails, their contexts are dropped below */
+  mupdf_text_index_free(mupdf_document->text_index);
+  mupdf_prefetch_free(mupdf_document->prefetch);
+  if (mupdf_document->render_pool != NULL) {
+    g_thread_pool_free(mupdf_document->render_pool, FALSE, TRUE);
+  }
+  if (mupdf_document->thumbnail_pool != NULL) {
+    g_thread_pool_free(mupdf_document->thumbnail_pool, FALSE, TRUE);
+  }
+  mupdf_watchdog_free(mupdf_document->watchdog);
+
+  /* reported before the document is dropped, the pages are cleared already, so the memory figures are peaks */
+  g_debug("memory budget: %zu bytes, store: %zu bytes, display lists: %zu bytes (peak %zu), texts: %zu bytes "
+          "(peak %zu)",
+          mupdf_document->memory_budget, mupdf_document->store_budget, mupdf_document->display_lists.budget,
+          mupdf_document->display_lists.peak, mupdf_document->texts.budget, mupdf_document->texts.peak);
+  g_debug("page cache: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses, %" G_GUINT64_FORMAT " evictions",
+          mupdf_document->pages.hits, mupdf_document->pages.misses, mupdf_document->pages.evictions);
+  g_debug("display list cache: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses, %" G_GUINT64_FORMAT
+          " evictions",
+          mupdf_document->display_lists.hits, mupdf_document->display_lists.misses,
+          mupdf_document->display_lists.evictions);
+  g_debug("text cache: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses, %" G_GUINT64_FORMAT " evictions",
+          mupdf_document->texts.hits, mupdf_document->texts.misses, mupdf_document->texts.evictions);
+  g_debug("raster cache: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses, %" G_GUINT64_FORMAT " evictions",
+          mupdf_document->rasters.cache.hits, mupdf_document->rasters.cache.misses,
+          mupdf_document->rasters.cache.evictions);
+  mupdf_stats_dump(mupdf_document, zathura_document_get_path(document));
+
+  mupdf_document_lock(mupdf_document);
+
+  mupdf_document_drop_attachments(mupdf_document, mupdf_document->ctx);
   fz_drop_document(mupdf_document->ctx, mupdf_document->document);
+  mupdf_document_drop_contexts(mupdf_document);
   fz_drop_context(mupdf_document->ctx);
 
-  g_mutex_unlock(&mupdf_document->mutex);
+  mupdf_document_unlock(mupdf_document);
+
+  /* the document read from the mapping until it was dropped */
+  if (mupdf_document->mapped != NULL) {
+    g_mapped_file_unref(mupdf_document->mapped);
+  }
+
+  mupdf_rasters_clear(&mupdf_document->rasters);
+  mupdf_cache_clear(&mupdf_document->texts);
+  mupdf_cache_clear(&mupdf_document->display_lists);
+  mupdf_cache_clear(&mupdf_document->pages);
+  g_hash_table_unref(mupdf_document->contexts);
+  if (mupdf_document->destinations != NULL) {
+    g_hash_table_unref(mupdf_document->destinations);
+  }
+  for (unsigned int i = 0; i < LENGTH(mupdf_document->locks); i++) {
+    g_mutex_clear(&mupdf_document->locks[i]);
+  }
+  g_mutex_clear(&mupdf_document->contexts_mutex);
   g_mutex_clear(&mupdf_document->mutex);
+  mupdf_stats_clear(&mupdf_document->stats);
 
   free(mupdf_document);
   zathura_document_set_data(document, NULL);
@@ -118,6 +369,17 @@ zathura_error_t pdf_document_free(zathura_document_t* document, void* data) {
   return ZATHURA_ERROR_OK;
 }
 
+/* if path names the file the document was read from */
+static bool pdf_document_is_source(zathura_document_t* document, const char* path, struct stat* info) {
+  const char* source = zathura_document_get_path(document);
+  struct stat path_info;
+  if (source == NULL || stat(source, info) != 0 || stat(path, &path_info) != 0) {
+    return false;
+  }
+
+  return info->st_dev == path_info.st_dev && info->st_ino == path_info.st_ino;
+}
+
 zathura_error_t pdf_document_save_as(zathura_document_t* document, void* data, const char* path) {
   mupdf_document_t* mupdf_document = data;
 
@@ -125,17 +387,60 @@ zathura_error_t pdf_document_save_as(zathura_document_t* document, void* data, c
     return ZATHURA_ERROR_INVALID_ARGUMENTS;
   }
 
-  g_mutex_lock(&mupdf_document->mutex);
-  fz_try(mupdf_document->ctx) {
-    pdf_save_document(mupdf_document->ctx, (pdf_document*)mupdf_document->document, path, NULL);
-  }
-  fz_catch(mupdf_document->ctx) {
-    g_mutex_unlock(&mupdf_document->mutex);
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
     return ZATHURA_ERROR_UNKNOWN;
   }
-  g_mutex_unlock(&mupdf_document->mutex);
 
-  return ZATHURA_ERROR_OK;
+  pdf_document* pdf_document = pdf_specifics(ctx, mupdf_document->document);
+  if (pdf_document == NULL) {
+    return ZATHURA_ERROR_NOT_IMPLEMENTED;
+  }
+
+  struct stat info;
+  const bool in_place = pdf_document_is_source(document, path, &info);
+
+  zathura_error_t error     = ZATHURA_ERROR_OK;
+  gchar* volatile temporary = NULL;
+
+  mupdf_document_lock(mupdf_document);
+  fz_try(ctx) {
+    pdf_write_options options = pdf_default_write_options;
+    if (in_place == true && mupdf_document->incremental_save == true &&
+        pdf_can_be_saved_incrementally(ctx, pdf_document) != 0) {
+      /* the edits are appended to the file as a new revision, the rest of it is neither read nor written */
+      options.do_incremental = 1;
+      pdf_save_document(ctx, pdf_document, path, &options);
+    } else if (in_place == true) {
+      /* the document is still read from the file, so it is only replaced once the new one is complete */
+      temporary = g_strconcat(path, ".XXXXXX", NULL);
+      int fd    = g_mkstemp(temporary);
+      if (fd < 0) {
+        fz_throw(ctx, FZ_ERROR_SYSTEM, "cannot create a temporary file next to %s", path);
+      }
+      g_close(fd, NULL);
+
+      pdf_save_document(ctx, pdf_document, temporary, &options);
+      if (g_chmod(temporary, info.st_mode & 07777) != 0 || g_rename(temporary, path) != 0) {
+        fz_throw(ctx, FZ_ERROR_SYSTEM, "cannot replace %s", path);
+      }
+    } else {
+      pdf_save_document(ctx, pdf_document, path, &options);
+    }
+  }
+  fz_catch(ctx) {
+    error = ZATHURA_ERROR_UNKNOWN;
+  }
+  mupdf_document_unlock(mupdf_document);
+
+  if (temporary != NULL) {
+    if (error != ZATHURA_ERROR_OK) {
+      g_unlink(temporary);
+    }
+    g_free(temporary);
+  }
+
+  return error;
 }
 
 girara_list_t* pdf_document_get_information(zathura_document_t* document, void* data, zathura_error_t* error) {
@@ -155,17 +460,26 @@ girara_list_t* pdf_document_get_information(zathura_document_t* document, void*
     return NULL;
   }
 
-  g_mutex_lock(&mupdf_document->mutex);
-  fz_try(mupdf_document->ctx) {
-    pdf_document* pdf_document = pdf_specifics(mupdf_document->ctx, mupdf_document->document);
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_UNKNOWN;
+    }
+    girara_list_free(list);
+    return NULL;
+  }
+
+  mupdf_document_lock(mupdf_document);
+  fz_try(ctx) {
+    pdf_document* pdf_document = pdf_specifics(ctx, mupdf_document->document);
     if (pdf_document == NULL) {
       girara_list_free(list);
       list = NULL;
       break;
     }
 
-    pdf_obj* trailer   = pdf_trailer(mupdf_document->ctx, pdf_document);
-    pdf_obj* info_dict = pdf_dict_get(mupdf_document->ctx, trailer, PDF_NAME(Info));
+    pdf_obj* trailer   = pdf_trailer(ctx, pdf_document);
+    pdf_obj* info_dict = pdf_dict_get(ctx, trailer, PDF_NAME(Info));
 
     /* get string values */
     typedef struct info_value_s {
@@ -180,12 +494,12 @@ girara_list_t* pdf_document_get_information(zathura_document_t* document, void*
     };
 
     for (unsigned int i = 0; i < LENGTH(string_values); i++) {
-      pdf_obj* value = pdf_dict_gets(mupdf_document->ctx, info_dict, string_values[i].property);
+      pdf_obj* value = pdf_dict_gets(ctx, info_dict, string_values[i].property);
       if (value == NULL) {
         continue;
       }
 
-      const char* str_value = pdf_to_text_string(mupdf_document->ctx, value);
+      const char* str_value = pdf_to_text_string(ctx, value);
       if (str_value == NULL || strlen(str_value) == 0) {
         continue;
       }
@@ -204,12 +518,12 @@ girara_list_t* pdf_document_get_information(zathura_document_t* document, void*
     };
 
     for (unsigned int i = 0; i < LENGTH(time_values); i++) {
-      pdf_obj* value = pdf_dict_gets(mupdf_document->ctx, info_dict, time_values[i].property);
+      pdf_obj* value = pdf_dict_gets(ctx, info_dict, time_values[i].property);
       if (value == NULL) {
         continue;
       }
 
-      const char* str_value = pdf_to_text_string(mupdf_document->ctx, value);
+      const char* str_value = pdf_to_text_string(ctx, value);
       if (str_value == NULL || strlen(str_value) == 0) {
         continue;
       }
@@ -224,14 +538,14 @@ girara_list_t* pdf_document_get_information(zathura_document_t* document, void*
       }
     }
   }
-  fz_catch(mupdf_document->ctx) {
+  fz_catch(ctx) {
     if (error != NULL) {
       *error = ZATHURA_ERROR_UNKNOWN;
     }
     girara_list_free(list);
     list = NULL;
   }
-  g_mutex_unlock(&mupdf_document->mutex);
+  mupdf_document_unlock(mupdf_document);
 
   return list;
 }
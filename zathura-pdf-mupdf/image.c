@@ -7,7 +7,18 @@
 #include "plugin.h"
 #include "utils.h"
 
-static void pdf_zathura_image_free(void* image) {
+/* the image is referenced so that it outlives the page's collected images */
+typedef struct mupdf_image_s {
+  zathura_image_t image;
+  mupdf_document_t* mupdf_document;
+} mupdf_image_t;
+
+static void pdf_zathura_image_free(void* data) {
+  mupdf_image_t* image = data;
+  fz_context* ctx      = mupdf_document_get_context(image->mupdf_document);
+  if (ctx != NULL) {
+    fz_drop_image(ctx, image->image.data);
+  }
   g_free(image);
 }
 
@@ -29,6 +40,10 @@ girara_list_t* pdf_page_images_get(zathura_page_t* page, void* data, zathura_err
 
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
 
+  if (mupdf_page == NULL) {
+    goto error_ret;
+  }
+
   /* Setup image list */
   list = girara_list_new_with_free(pdf_zathura_image_free);
   if (list == NULL) {
@@ -38,26 +53,33 @@ girara_list_t* pdf_page_images_get(zathura_page_t* page, void* data, zathura_err
     goto error_free;
   }
 
-  /* Extract images */
-  g_mutex_lock(&mupdf_document->mutex);
-  if (!mupdf_page->extracted_text) {
-    mupdf_page_extract_text(mupdf_document, mupdf_page);
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    goto error_free;
+  }
+
+  /* Collect images */
+  g_mutex_lock(&mupdf_page->mutex);
+  GArray* images = mupdf_page_get_images(mupdf_document, mupdf_page);
+  if (images == NULL) {
+    g_mutex_unlock(&mupdf_page->mutex);
+    goto error_free;
   }
 
-  for (fz_stext_block* block = mupdf_page->text->first_block; block; block = block->next) {
-    if (block->type == FZ_STEXT_BLOCK_IMAGE) {
-      zathura_image_t* zathura_image = g_malloc(sizeof(zathura_image_t));
+  for (guint i = 0; i < images->len; i++) {
+    mupdf_page_image_t* entry = &g_array_index(images, mupdf_page_image_t, i);
+    mupdf_image_t* image      = g_malloc(sizeof(mupdf_image_t));
 
-      zathura_image->position.x1 = block->bbox.x0;
-      zathura_image->position.y1 = block->bbox.y0;
-      zathura_image->position.x2 = block->bbox.x1;
-      zathura_image->position.y2 = block->bbox.y1;
-      zathura_image->data        = block->u.i.image;
+    image->mupdf_document    = mupdf_document;
+    image->image.position.x1 = entry->bbox.x0;
+    image->image.position.y1 = entry->bbox.y0;
+    image->image.position.x2 = entry->bbox.x1;
+    image->image.position.y2 = entry->bbox.y1;
+    image->image.data        = fz_keep_image(ctx, entry->image);
 
-      girara_list_append(list, zathura_image);
-    }
+    girara_list_append(list, image);
   }
-  g_mutex_unlock(&mupdf_document->mutex);
+  g_mutex_unlock(&mupdf_page->mutex);
 
   return list;
 
@@ -92,67 +114,16 @@ cairo_surface_t* pdf_page_image_get_cairo(zathura_page_t* page, void* data, zath
     if (error != NULL) {
       *error = ZATHURA_ERROR_INVALID_ARGUMENTS;
     }
+    goto error_ret;
   }
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
-
-  fz_image* mupdf_image = image->data;
-
-  fz_pixmap* pixmap        = NULL;
-  cairo_surface_t* surface = NULL;
-
-  g_mutex_lock(&mupdf_document->mutex);
-  pixmap = fz_get_pixmap_from_image(mupdf_page->ctx, mupdf_image, NULL, NULL, 0, 0);
-  if (pixmap == NULL) {
-    goto error_free;
-  }
-
-  surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, mupdf_image->w, mupdf_image->h);
-  if (surface == NULL) {
-    goto error_free;
-  }
-
-  unsigned char* surface_data = cairo_image_surface_get_data(surface);
-  int rowstride               = cairo_image_surface_get_stride(surface);
-
-  unsigned char* s = fz_pixmap_samples(mupdf_page->ctx, pixmap);
-  unsigned int n   = fz_pixmap_components(mupdf_page->ctx, pixmap);
-
-  const int height = fz_pixmap_height(mupdf_page->ctx, pixmap);
-  const int width  = fz_pixmap_width(mupdf_page->ctx, pixmap);
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      guchar* p = surface_data + y * rowstride + x * 4;
-
-      // RGB
-      if (n == 3) {
-        p[0] = s[2];
-        p[1] = s[1];
-        p[2] = s[0];
-        // Gray-scale or mask
-      } else {
-        p[0] = s[0];
-        p[1] = s[0];
-        p[2] = s[0];
-      }
-      s += n;
-    }
-  }
-
-  fz_drop_pixmap(mupdf_page->ctx, pixmap);
-  g_mutex_unlock(&mupdf_document->mutex);
-
-  return surface;
-
-error_free:
-  g_mutex_unlock(&mupdf_document->mutex);
-
-  if (pixmap != NULL) {
-    fz_drop_pixmap(mupdf_page->ctx, pixmap);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    goto error_ret;
   }
 
-  if (surface != NULL) {
-    cairo_surface_destroy(surface);
-  }
+  /* images are immutable and referenced by the image list, so no lock is needed */
+  return mupdf_image_get_cairo(ctx, image->data, 0, 0);
 
 error_ret:
 
@@ -2,10 +2,11 @@
 
 #include <girara/datastructures.h>
 
-#include "math.h"
 #include "plugin.h"
+#include "utils.h"
 
-static void build_index(fz_context* ctx, fz_document* document, fz_outline* outline, girara_tree_node_t* root);
+static void build_index(mupdf_document_t* mupdf_document, fz_context* ctx, fz_outline_iterator* iterator,
+                        girara_tree_node_t* root, unsigned int depth);
 
 girara_tree_node_t* pdf_document_index_generate(zathura_document_t* document, void* data, zathura_error_t* error) {
   if (document == NULL || data == NULL) {
@@ -16,80 +17,73 @@ girara_tree_node_t* pdf_document_index_generate(zathura_document_t* document, vo
   }
 
   mupdf_document_t* mupdf_document = data;
-  g_mutex_lock(&mupdf_document->mutex);
-
-  /* get outline */
-  fz_outline* outline = fz_load_outline(mupdf_document->ctx, mupdf_document->document);
-  if (outline == NULL) {
-    g_mutex_unlock(&mupdf_document->mutex);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
     if (error != NULL) {
       *error = ZATHURA_ERROR_UNKNOWN;
     }
     return NULL;
   }
 
-  /* generate index */
-  girara_tree_node_t* root = girara_node_new(zathura_index_element_new("ROOT"));
-  build_index(mupdf_document->ctx, mupdf_document->document, outline, root);
-
-  /* free outline */
-  fz_drop_outline(mupdf_document->ctx, outline);
-
-  g_mutex_unlock(&mupdf_document->mutex);
-  return root;
-}
+  mupdf_document_lock(mupdf_document);
 
-static void build_index(fz_context* ctx, fz_document* document, fz_outline* outline, girara_tree_node_t* root) {
-  if (outline == NULL || root == NULL) {
-    return;
+  /* the outline is walked in place instead of being loaded as a whole, which for pdfs would resolve the page of
+   * every entry once more */
+  fz_outline_iterator* volatile iterator = NULL;
+  girara_tree_node_t* root               = girara_node_new(zathura_index_element_new("ROOT"));
+  fz_try(ctx) {
+    iterator = fz_new_outline_iterator(ctx, mupdf_document->document);
+    build_index(mupdf_document, ctx, iterator, root, 1);
+  }
+  fz_always(ctx) {
+    fz_drop_outline_iterator(ctx, iterator);
   }
+  /* the entries up to a broken one are kept */
+  fz_catch(ctx) {}
 
-  while (outline != NULL) {
-    zathura_index_element_t* index_element = zathura_index_element_new(outline->title);
-    zathura_link_target_t target           = {ZATHURA_LINK_DESTINATION_UNKNOWN, NULL, 0, -1, -1, -1, -1, 0};
-    zathura_link_type_t type               = ZATHURA_LINK_INVALID;
-    zathura_rectangle_t rect               = {.x1 = 0, .y1 = 0, .x2 = 0, .y2 = 0};
+  mupdf_document_unlock(mupdf_document);
 
-    if (outline->uri == NULL) {
-      type = ZATHURA_LINK_NONE;
-    } else if (fz_is_external_link(ctx, outline->uri) == 1) {
-      if (strstr(outline->uri, "file://") == outline->uri) {
-        type         = ZATHURA_LINK_GOTO_REMOTE;
-        target.value = outline->uri;
-      } else {
-        type         = ZATHURA_LINK_URI;
-        target.value = outline->uri;
-      }
-    } else {
-      float x = 0;
-      float y = 0;
+  if (girara_node_get_num_children(root) == 0) {
+    girara_node_free(root);
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_UNKNOWN;
+    }
+    return NULL;
+  }
 
-      fz_location location = fz_resolve_link(ctx, document, outline->uri, &x, &y);
+  return root;
+}
 
-      type                    = ZATHURA_LINK_GOTO_DEST;
-      target.destination_type = ZATHURA_LINK_DESTINATION_XYZ;
-      target.page_number      = fz_page_number_from_location(ctx, document, location);
-      if (!isnan(x)) {
-        target.left = x;
-      }
-      if (!isnan(y)) {
-        target.top = y;
-      }
-      target.zoom = 0.0;
+static void build_index(mupdf_document_t* mupdf_document, fz_context* ctx, fz_outline_iterator* iterator,
+                        girara_tree_node_t* root, unsigned int depth) {
+  do {
+    fz_outline_item* item = fz_outline_iterator_item(ctx, iterator);
+    if (item == NULL) {
+      return;
     }
 
+    zathura_index_element_t* index_element = zathura_index_element_new(item->title);
+    zathura_link_target_t target;
+    zathura_link_type_t type = mupdf_document_resolve_link(mupdf_document, ctx, item->uri, &target);
+    zathura_rectangle_t rect = {.x1 = 0, .y1 = 0, .x2 = 0, .y2 = 0};
+
     index_element->link = zathura_link_new(type, rect, target);
     if (index_element->link == NULL) {
-      outline = outline->next;
+      zathura_index_element_free(index_element);
       continue;
     }
 
     girara_tree_node_t* node = girara_node_append_data(root, index_element);
 
-    if (outline->down != NULL) {
-      build_index(ctx, document, outline->down, node);
+    /* a down move that returns 1 lands on an empty position, which has to be left again as well */
+    if (mupdf_document->outline_depth == 0 || depth < mupdf_document->outline_depth) {
+      int moved = fz_outline_iterator_down(ctx, iterator);
+      if (moved == 0) {
+        build_index(mupdf_document, ctx, iterator, node, depth + 1);
+      }
+      if (moved >= 0) {
+        fz_outline_iterator_up(ctx, iterator);
+      }
     }
-
-    outline = outline->next;
-  }
+  } while (fz_outline_iterator_next(ctx, iterator) == 0);
 }
@@ -3,7 +3,7 @@
 #include <glib.h>
 
 #include "plugin.h"
-#include "math.h"
+#include "utils.h"
 
 girara_list_t* pdf_page_links_get(zathura_page_t* page, void* data, zathura_error_t* error) {
   if (page == NULL) {
@@ -15,11 +15,15 @@ girara_list_t* pdf_page_links_get(zathura_page_t* page, void* data, zathura_erro
 
   mupdf_page_t* mupdf_page     = data;
   zathura_document_t* document = zathura_page_get_document(page);
-  if (document == NULL || mupdf_page == NULL || mupdf_page->page == NULL) {
+  if (document == NULL || mupdf_page == NULL) {
     goto error_ret;
   }
 
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    goto error_ret;
+  }
 
   girara_list_t* list = girara_list_new_with_free((girara_free_function_t)zathura_link_free);
   if (list == NULL) {
@@ -29,52 +33,22 @@ girara_list_t* pdf_page_links_get(zathura_page_t* page, void* data, zathura_erro
     goto error_free;
   }
 
-  g_mutex_lock(&mupdf_document->mutex);
-
-  fz_link* link = fz_load_links(mupdf_document->ctx, mupdf_page->page);
-  for (; link != NULL; link = link->next) {
-    /* extract position */
-    zathura_rectangle_t position;
-    position.x1 = link->rect.x0;
-    position.x2 = link->rect.x1;
-    position.y1 = link->rect.y0;
-    position.y2 = link->rect.y1;
-
-    zathura_link_type_t type     = ZATHURA_LINK_INVALID;
-    zathura_link_target_t target = {ZATHURA_LINK_DESTINATION_UNKNOWN, NULL, 0, -1, -1, -1, -1, 0};
-
-    if (fz_is_external_link(mupdf_document->ctx, link->uri) == 1) {
-      if (strstr(link->uri, "file://") == link->uri) {
-        type         = ZATHURA_LINK_GOTO_REMOTE;
-        target.value = link->uri;
-      } else {
-        type         = ZATHURA_LINK_URI;
-        target.value = link->uri;
-      }
-    } else {
-      float x = 0;
-      float y = 0;
-
-      fz_location location = fz_resolve_link(mupdf_document->ctx, mupdf_document->document, link->uri, &x, &y);
-
-      type                    = ZATHURA_LINK_GOTO_DEST;
-      target.destination_type = ZATHURA_LINK_DESTINATION_XYZ;
-      target.page_number      = fz_page_number_from_location(mupdf_document->ctx, mupdf_document->document, location);
-      if (!isnan(x)) {
-        target.left = x;
-      }
-      if (!isnan(y)) {
-        target.top = y;
-      }
-      target.zoom = 0.0;
-    }
+  /* the links are resolved once, later calls only copy them */
+  mupdf_document_lock(mupdf_document);
+  GArray* links = mupdf_page_get_links(mupdf_document, mupdf_page, ctx);
+  if (links == NULL) {
+    mupdf_document_unlock(mupdf_document);
+    goto error_free;
+  }
 
-    zathura_link_t* zathura_link = zathura_link_new(type, position, target);
+  for (guint i = 0; i < links->len; i++) {
+    mupdf_page_link_t* link      = &g_array_index(links, mupdf_page_link_t, i);
+    zathura_link_t* zathura_link = zathura_link_new(link->type, link->position, link->target);
     if (zathura_link != NULL) {
       girara_list_append(list, zathura_link);
     }
   }
-  g_mutex_unlock(&mupdf_document->mutex);
+  mupdf_document_unlock(mupdf_document);
 
   return list;
 
@@ -1,8 +1,8 @@
 /* SPDX-License-Identifier: Zlib */
 
-#include <math.h>
 #include <mupdf/pdf.h>
 #include "plugin.h"
+#include "utils.h"
 
 zathura_error_t pdf_page_init(zathura_page_t* page) {
   if (page == NULL) {
@@ -18,30 +18,40 @@ zathura_error_t pdf_page_init(zathura_page_t* page) {
     return ZATHURA_ERROR_OUT_OF_MEMORY;
   }
 
-  g_mutex_lock(&mupdf_document->mutex);
-  mupdf_page->ctx = mupdf_document->ctx;
-  if (mupdf_page->ctx == NULL) {
-    goto error_free;
-  }
+  g_mutex_init(&mupdf_page->mutex);
 
-  /* load page */
-  fz_try(mupdf_page->ctx) {
-    mupdf_page->page = fz_load_page(mupdf_document->ctx, mupdf_document->document, index);
-  }
-  fz_catch(mupdf_page->ctx) {
-    goto error_free;
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    pdf_page_clear(page, mupdf_page);
+    return ZATHURA_ERROR_UNKNOWN;
   }
 
-  mupdf_page->bbox = fz_bound_page(mupdf_document->ctx, (fz_page*)mupdf_page->page);
+  mupdf_page->index = index;
 
-  /* setup text */
-  mupdf_page->extracted_text = false;
+  mupdf_document_lock(mupdf_document);
 
-  mupdf_page->text = fz_new_stext_page(mupdf_page->ctx, mupdf_page->bbox);
-  if (mupdf_page->text == NULL) {
+  /* the page itself and its text are loaded on first use, for pdfs the bounds are read from the page object */
+  fz_try(ctx) {
+    pdf_document* pdf_document = pdf_specifics(ctx, mupdf_document->document);
+    if (pdf_document != NULL) {
+      fz_rect mediabox;
+      fz_matrix page_ctm;
+      pdf_obj* page_obj = pdf_lookup_page_obj(ctx, pdf_document, index);
+      pdf_page_obj_transform(ctx, page_obj, &mediabox, &page_ctm);
+      mupdf_page->bbox = fz_transform_rect(mediabox, page_ctm);
+    } else {
+      fz_page* loaded = mupdf_page_get_page(mupdf_document, mupdf_page, ctx);
+      if (loaded == NULL) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "cannot load page %u", index);
+      }
+      mupdf_page->bbox = fz_bound_page(ctx, loaded);
+    }
+  }
+  fz_catch(ctx) {
     goto error_free;
   }
-  g_mutex_unlock(&mupdf_document->mutex);
+
+  mupdf_document_unlock(mupdf_document);
 
   zathura_page_set_data(page, mupdf_page);
 
@@ -52,7 +62,7 @@ zathura_error_t pdf_page_init(zathura_page_t* page) {
   return ZATHURA_ERROR_OK;
 
 error_free:
-  g_mutex_unlock(&mupdf_document->mutex);
+  mupdf_document_unlock(mupdf_document);
 
   pdf_page_clear(page, mupdf_page);
 
@@ -67,20 +77,39 @@ zathura_error_t pdf_page_clear(zathura_page_t* page, void* data) {
   mupdf_page_t* mupdf_page         = data;
   zathura_document_t* document     = zathura_page_get_document(page);
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+
+  /* the prefetcher may be working on the page */
+  if (mupdf_page != NULL) {
+    mupdf_prefetch_cancel(mupdf_document->prefetch);
+    mupdf_cache_remove(&mupdf_document->display_lists, &mupdf_page->display_list_entry);
+    mupdf_cache_remove(&mupdf_document->texts, &mupdf_page->text_entry);
+    mupdf_cache_remove(&mupdf_document->pages, &mupdf_page->page_entry);
+  }
 
-  g_mutex_lock(&mupdf_document->mutex);
+  mupdf_document_lock(mupdf_document);
   if (mupdf_page != NULL) {
+    if (mupdf_page->display_list != NULL) {
+      fz_drop_display_list(ctx, mupdf_page->display_list);
+    }
+
+    mupdf_text_lines_free(mupdf_page->text_lines);
     if (mupdf_page->text != NULL) {
-      fz_drop_stext_page(mupdf_page->ctx, mupdf_page->text);
+      fz_drop_stext_page(ctx, mupdf_page->text);
     }
 
+    mupdf_page_drop_images(mupdf_page, ctx);
+    mupdf_page_drop_links(mupdf_page);
+    mupdf_page_drop_annotation_index(mupdf_page);
+
     if (mupdf_page->page != NULL) {
-      fz_drop_page(mupdf_document->ctx, mupdf_page->page);
+      fz_drop_page(ctx, mupdf_page->page);
     }
 
+    g_mutex_clear(&mupdf_page->mutex);
     free(mupdf_page);
   }
-  g_mutex_unlock(&mupdf_document->mutex);
+  mupdf_document_unlock(mupdf_document);
 
   return ZATHURA_ERROR_UNKNOWN;
 }
@@ -97,17 +126,28 @@ zathura_error_t pdf_page_get_label(zathura_page_t* page, void* data, char** labe
   }
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
 
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
   char buf[16];
 
-  g_mutex_lock(&mupdf_document->mutex);
-  fz_try(mupdf_page->ctx) {
-    fz_page_label(mupdf_page->ctx, mupdf_page->page, buf, sizeof(buf));
+  mupdf_document_lock(mupdf_document);
+  fz_page* loaded = mupdf_page_get_page(mupdf_document, mupdf_page, ctx);
+  if (loaded == NULL) {
+    mupdf_document_unlock(mupdf_document);
+    return ZATHURA_ERROR_UNKNOWN;
   }
-  fz_catch(mupdf_page->ctx) {
-    g_mutex_unlock(&mupdf_document->mutex);
+
+  fz_try(ctx) {
+    fz_page_label(ctx, loaded, buf, sizeof(buf));
+  }
+  fz_catch(ctx) {
+    mupdf_document_unlock(mupdf_document);
     return ZATHURA_ERROR_UNKNOWN;
   }
-  g_mutex_unlock(&mupdf_document->mutex);
+  mupdf_document_unlock(mupdf_document);
 
   // fz_page_label() may return an empty string if the label is undefined.
   if (buf[0] != '\0') {
@@ -121,7 +161,7 @@ zathura_error_t pdf_page_get_label(zathura_page_t* page, void* data, char** labe
 
 girara_list_t* pdf_page_get_notes(zathura_page_t* page, void* data, zathura_error_t* error) {
   mupdf_page_t* mupdf_page = data;
-  if (mupdf_page == NULL || mupdf_page->page == NULL) {
+  if (mupdf_page == NULL) {
     if (error != NULL) {
       *error = ZATHURA_ERROR_INVALID_ARGUMENTS;
     }
@@ -146,15 +186,22 @@ girara_list_t* pdf_page_get_notes(zathura_page_t* page, void* data, zathura_erro
     return NULL;
   }
 
-  fz_context* ctx = mupdf_page->ctx;
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    girara_list_free(notes);
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_UNKNOWN;
+    }
+    return NULL;
+  }
 
-  g_mutex_lock(&mupdf_document->mutex);
+  mupdf_document_lock(mupdf_document);
 
   /* Get PDF-specific page - may fail for non-PDF documents */
-  pdf_page* ppage = pdf_page_from_fz_page(ctx, mupdf_page->page);
+  pdf_page* ppage = pdf_page_from_fz_page(ctx, mupdf_page_get_page(mupdf_document, mupdf_page, ctx));
   if (ppage == NULL) {
     /* Not a PDF page, return empty list */
-    g_mutex_unlock(&mupdf_document->mutex);
+    mupdf_document_unlock(mupdf_document);
     if (error != NULL) {
       *error = ZATHURA_ERROR_OK;
     }
@@ -188,7 +235,7 @@ girara_list_t* pdf_page_get_notes(zathura_page_t* page, void* data, zathura_erro
     g_warning("pdf_page_get_notes: MuPDF exception while reading notes: %s", fz_caught_message(ctx));
   }
 
-  g_mutex_unlock(&mupdf_document->mutex);
+  mupdf_document_unlock(mupdf_document);
 
   g_message("pdf_page_get_notes: Found %zu notes on page %u",
             girara_list_size(notes), zathura_page_get_index(page));
@@ -201,7 +248,7 @@ girara_list_t* pdf_page_get_notes(zathura_page_t* page, void* data, zathura_erro
 
 zathura_error_t pdf_page_delete_note(zathura_page_t* page, void* data, double x, double y) {
   mupdf_page_t* mupdf_page = data;
-  if (mupdf_page == NULL || mupdf_page->page == NULL) {
+  if (mupdf_page == NULL) {
     return ZATHURA_ERROR_INVALID_ARGUMENTS;
   }
 
@@ -211,46 +258,50 @@ zathura_error_t pdf_page_delete_note(zathura_page_t* page, void* data, double x,
   }
 
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
-  fz_context* ctx = mupdf_page->ctx;
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
 
-  g_mutex_lock(&mupdf_document->mutex);
+  mupdf_document_lock(mupdf_document);
 
   /* Get PDF-specific page - may fail for non-PDF documents */
-  pdf_page* ppage = pdf_page_from_fz_page(ctx, mupdf_page->page);
+  pdf_page* ppage = pdf_page_from_fz_page(ctx, mupdf_page_get_page(mupdf_document, mupdf_page, ctx));
   if (ppage == NULL) {
-    g_mutex_unlock(&mupdf_document->mutex);
+    mupdf_document_unlock(mupdf_document);
     return ZATHURA_ERROR_UNKNOWN;
   }
 
   zathura_error_t result = ZATHURA_ERROR_UNKNOWN;
-  const double eps = 1.0;  /* Coordinate tolerance for matching */
 
   fz_try(ctx) {
-    for (pdf_annot* annot = pdf_first_annot(ctx, ppage); annot != NULL; annot = pdf_next_annot(ctx, annot)) {
-      if (pdf_annot_type(ctx, annot) == PDF_ANNOT_TEXT) {
-        fz_rect rect = pdf_annot_rect(ctx, annot);
-
-        /* Match by position */
-        if (fabs(rect.x0 - x) < eps && fabs(rect.y0 - y) < eps) {
-          g_message("pdf_page_delete_note: Found annotation at (%.1f, %.1f), deleting", rect.x0, rect.y0);
-          pdf_delete_annot(ctx, ppage, annot);
-          result = ZATHURA_ERROR_OK;
-          break;
-        }
-      }
+    pdf_annot* annot =
+        mupdf_page_find_annotation(mupdf_page, ctx, ppage, 1u << PDF_ANNOT_TEXT, fz_make_point(x, y), NULL, NULL);
+    if (annot != NULL) {
+      g_message("pdf_page_delete_note: Found annotation at (%.1f, %.1f), deleting", x, y);
+      mupdf_page_unindex_annotation(mupdf_page, ctx, annot);
+      pdf_delete_annot(ctx, ppage, annot);
+      result = ZATHURA_ERROR_OK;
     }
   } fz_catch(ctx) {
     g_warning("pdf_page_delete_note: MuPDF exception during deletion");
+    /* the grid may have missed the change, it is built again on the next lookup */
+    mupdf_page_drop_annotation_index(mupdf_page);
     result = ZATHURA_ERROR_UNKNOWN;
   }
 
-  g_mutex_unlock(&mupdf_document->mutex);
+  mupdf_document_unlock(mupdf_document);
+
+  if (result == ZATHURA_ERROR_OK) {
+    mupdf_page_invalidate(mupdf_document, mupdf_page);
+  }
+
   return result;
 }
 
 zathura_error_t pdf_page_update_note_content(zathura_page_t* page, void* data, double x, double y, const char* content) {
   mupdf_page_t* mupdf_page = data;
-  if (mupdf_page == NULL || mupdf_page->page == NULL) {
+  if (mupdf_page == NULL) {
     return ZATHURA_ERROR_INVALID_ARGUMENTS;
   }
 
@@ -264,100 +315,84 @@ zathura_error_t pdf_page_update_note_content(zathura_page_t* page, void* data, d
   }
 
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
-  fz_context* ctx = mupdf_page->ctx;
-
-  g_debug("pdf_page_update_note_content: called with coords (%.2f, %.2f), content='%.30s...'", x, y, content);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
 
-  g_mutex_lock(&mupdf_document->mutex);
+  mupdf_document_lock(mupdf_document);
 
   /* Get PDF-specific page - may fail for non-PDF documents */
-  pdf_page* ppage = pdf_page_from_fz_page(ctx, mupdf_page->page);
+  pdf_page* ppage = pdf_page_from_fz_page(ctx, mupdf_page_get_page(mupdf_document, mupdf_page, ctx));
   if (ppage == NULL) {
-    g_mutex_unlock(&mupdf_document->mutex);
-    g_debug("pdf_page_update_note_content: ppage is NULL (not a PDF?)");
+    mupdf_document_unlock(mupdf_document);
     return ZATHURA_ERROR_UNKNOWN;
   }
 
   zathura_error_t result = ZATHURA_ERROR_UNKNOWN;
-  const double eps = 1.0;  /* Coordinate tolerance for matching */
-
-  /* Count TEXT annotations BEFORE the update */
-  int text_annot_count_before = 0;
-  fz_try(ctx) {
-    for (pdf_annot* annot = pdf_first_annot(ctx, ppage); annot != NULL; annot = pdf_next_annot(ctx, annot)) {
-      if (pdf_annot_type(ctx, annot) == PDF_ANNOT_TEXT) {
-        text_annot_count_before++;
-        fz_rect rect = pdf_annot_rect(ctx, annot);
-        g_debug("pdf_page_update_note_content: BEFORE - TEXT annot #%d at (%.2f, %.2f)",
-                text_annot_count_before, rect.x0, rect.y0);
-      }
-    }
-  } fz_catch(ctx) {
-    g_warning("pdf_page_update_note_content: exception counting annotations before");
-  }
-  g_debug("pdf_page_update_note_content: BEFORE update - %d TEXT annotations exist", text_annot_count_before);
 
   fz_try(ctx) {
-    for (pdf_annot* annot = pdf_first_annot(ctx, ppage); annot != NULL; annot = pdf_next_annot(ctx, annot)) {
-      if (pdf_annot_type(ctx, annot) == PDF_ANNOT_TEXT) {
-        fz_rect rect = pdf_annot_rect(ctx, annot);
-
-        /* Match by position */
-        if (fabs(rect.x0 - x) < eps && fabs(rect.y0 - y) < eps) {
-          g_debug("pdf_page_update_note_content: MATCH FOUND at (%.2f, %.2f) - rect is (%.2f, %.2f, %.2f, %.2f)",
-                  rect.x0, rect.y0, rect.x0, rect.y0, rect.x1, rect.y1);
-          g_message("pdf_page_update_note_content: Found annotation at (%.1f, %.1f), updating content", rect.x0, rect.y0);
-          pdf_set_annot_contents(ctx, annot, content);
-          g_debug("pdf_page_update_note_content: called pdf_set_annot_contents()");
-          pdf_update_annot(ctx, annot);
-          g_debug("pdf_page_update_note_content: called pdf_update_annot()");
-          result = ZATHURA_ERROR_OK;
-          break;
-        } else {
-          g_debug("pdf_page_update_note_content: no match - annot at (%.2f, %.2f), looking for (%.2f, %.2f), diff=(%.2f, %.2f)",
-                  rect.x0, rect.y0, x, y, fabs(rect.x0 - x), fabs(rect.y0 - y));
-        }
-      }
+    pdf_annot* annot =
+        mupdf_page_find_annotation(mupdf_page, ctx, ppage, 1u << PDF_ANNOT_TEXT, fz_make_point(x, y), NULL, NULL);
+    if (annot != NULL) {
+      g_message("pdf_page_update_note_content: Found annotation at (%.1f, %.1f), updating content", x, y);
+      /* updating the appearance may move the note's rectangle */
+      mupdf_page_unindex_annotation(mupdf_page, ctx, annot);
+      pdf_set_annot_contents(ctx, annot, content);
+      pdf_update_annot(ctx, annot);
+      mupdf_page_index_annotation(mupdf_page, ctx, annot);
+      result = ZATHURA_ERROR_OK;
     }
   } fz_catch(ctx) {
     g_warning("pdf_page_update_note_content: MuPDF exception during update");
+    mupdf_page_drop_annotation_index(mupdf_page);
     result = ZATHURA_ERROR_UNKNOWN;
   }
 
-  /* Count TEXT annotations AFTER the update */
-  int text_annot_count_after = 0;
-  fz_try(ctx) {
-    for (pdf_annot* annot = pdf_first_annot(ctx, ppage); annot != NULL; annot = pdf_next_annot(ctx, annot)) {
-      if (pdf_annot_type(ctx, annot) == PDF_ANNOT_TEXT) {
-        text_annot_count_after++;
-        fz_rect rect = pdf_annot_rect(ctx, annot);
-        g_debug("pdf_page_update_note_content: AFTER - TEXT annot #%d at (%.2f, %.2f)",
-                text_annot_count_after, rect.x0, rect.y0);
-      }
-    }
-  } fz_catch(ctx) {
-    g_warning("pdf_page_update_note_content: exception counting annotations after");
+  if (result != ZATHURA_ERROR_OK) {
+    g_debug("pdf_page_update_note_content: no annotation found at (%.2f, %.2f)", x, y);
   }
-  g_debug("pdf_page_update_note_content: AFTER update - %d TEXT annotations exist (was %d)",
-          text_annot_count_after, text_annot_count_before);
 
-  if (text_annot_count_after != text_annot_count_before) {
-    g_warning("pdf_page_update_note_content: ANNOTATION COUNT CHANGED! before=%d, after=%d",
-              text_annot_count_before, text_annot_count_after);
-  }
+  mupdf_document_unlock(mupdf_document);
 
-  if (result != ZATHURA_ERROR_OK) {
-    g_debug("pdf_page_update_note_content: NO MATCHING annotation found at (%.2f, %.2f)", x, y);
+  if (result == ZATHURA_ERROR_OK) {
+    mupdf_page_invalidate(mupdf_document, mupdf_page);
   }
 
-  g_mutex_unlock(&mupdf_document->mutex);
   return result;
 }
 
 
+/* creates a sticky note, its appearance is synthesized together with the page's other new annotations */
+static pdf_annot* note_create(fz_context* ctx, pdf_page* ppage, void* item) {
+  zathura_note_t* note = item;
+
+  pdf_annot* volatile annot = NULL;
+  fz_try(ctx) {
+    /* Create a PDF_ANNOT_TEXT annotation (sticky note) */
+    annot = pdf_create_annot(ctx, ppage, PDF_ANNOT_TEXT);
+
+    /* Set annotation position - create a small rect for the sticky note icon */
+    /* Standard sticky note icon size is approximately 24x24 units */
+    fz_rect rect = fz_make_rect(note->x, note->y, note->x + 24.0, note->y + 24.0);
+    pdf_set_annot_rect(ctx, annot, rect);
+
+    /* Set the note content */
+    if (note->content != NULL && note->content[0] != '\0') {
+      pdf_set_annot_contents(ctx, annot, note->content);
+    }
+  }
+  fz_catch(ctx) {
+    pdf_drop_annot(ctx, annot);
+    fz_rethrow(ctx);
+  }
+
+  return annot;
+}
+
 zathura_error_t pdf_page_export_notes(zathura_page_t* page, void* data, girara_list_t* notes) {
   mupdf_page_t* mupdf_page = data;
-  if (mupdf_page == NULL || mupdf_page->page == NULL) {
+  if (mupdf_page == NULL) {
     return ZATHURA_ERROR_INVALID_ARGUMENTS;
   }
 
@@ -370,57 +405,15 @@ zathura_error_t pdf_page_export_notes(zathura_page_t* page, void* data, girara_l
     return ZATHURA_ERROR_INVALID_ARGUMENTS;
   }
 
-  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
-  fz_context* ctx = mupdf_page->ctx;
-
-  g_mutex_lock(&mupdf_document->mutex);
-
-  /* Get PDF-specific page - may fail for non-PDF documents */
-  pdf_page* ppage = pdf_page_from_fz_page(ctx, mupdf_page->page);
-  if (ppage == NULL) {
-    g_mutex_unlock(&mupdf_document->mutex);
-    g_warning("pdf_page_export_notes: Not a PDF page");
-    return ZATHURA_ERROR_UNKNOWN;
-  }
-
-  zathura_error_t result = ZATHURA_ERROR_OK;
-  unsigned int exported_count = 0;
-
-  fz_try(ctx) {
-    GIRARA_LIST_FOREACH_BODY(notes, zathura_note_t*, note,
-      /* Create a PDF_ANNOT_TEXT annotation (sticky note) */
-      pdf_annot* annot = pdf_create_annot(ctx, ppage, PDF_ANNOT_TEXT);
-      if (annot == NULL) {
-        g_warning("pdf_page_export_notes: Failed to create annotation");
-        continue;
-      }
-
-      /* Set annotation position - create a small rect for the sticky note icon */
-      /* Standard sticky note icon size is approximately 24x24 units */
-      fz_rect rect = fz_make_rect(note->x, note->y, note->x + 24.0, note->y + 24.0);
-      pdf_set_annot_rect(ctx, annot, rect);
-
-      /* Set the note content */
-      if (note->content != NULL && note->content[0] != '\0') {
-        pdf_set_annot_contents(ctx, annot, note->content);
-      }
-
-      /* Update the annotation to apply changes */
-      pdf_update_annot(ctx, annot);
-
-      exported_count++;
-      g_debug("pdf_page_export_notes: Exported note at (%.1f, %.1f) with content: %.30s...",
-              note->x, note->y, note->content ? note->content : "(empty)");
-    );
-  } fz_catch(ctx) {
-    g_warning("pdf_page_export_notes: MuPDF exception during export");
-    result = ZATHURA_ERROR_UNKNOWN;
-  }
-
-  g_mutex_unlock(&mupdf_document->mutex);
+  /* all notes of the list go to this page, whichever page they name */
+  mupdf_annotation_batch_t batch = {.page = mupdf_page, .items = g_ptr_array_new(), .created = 0};
+  GIRARA_LIST_FOREACH_BODY(notes, zathura_note_t*, note,
+    g_ptr_array_add(batch.items, note);
+  );
 
-  g_message("pdf_page_export_notes: Exported %u notes to page %u",
-            exported_count, zathura_page_get_index(page));
+  zathura_error_t result = mupdf_document_create_annotations(zathura_document_get_data(document), &batch, 1,
+                                                             "Export notes", note_create);
+  g_ptr_array_free(batch.items, TRUE);
 
   return result;
 }
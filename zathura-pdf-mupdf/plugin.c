@@ -8,6 +8,42 @@
 #define PDF_MIMETYPE
 #endif
 
+#if defined(HAVE_XPS)
+#define XPS_MIMETYPES "application/oxps",
+#else
+#define XPS_MIMETYPES
+#endif
+
+#if defined(HAVE_EPUB)
+#define EPUB_MIMETYPES "application/epub+zip",
+#else
+#define EPUB_MIMETYPES
+#endif
+
+#if defined(HAVE_FB2)
+#define FB2_MIMETYPES "application/x-fictionbook", "text/xml",
+#else
+#define FB2_MIMETYPES
+#endif
+
+#if defined(HAVE_MOBI)
+#define MOBI_MIMETYPES "application/x-mobipocket-ebook",
+#else
+#define MOBI_MIMETYPES
+#endif
+
+#if defined(HAVE_SVG)
+#define SVG_MIMETYPES "image/svg+xml",
+#else
+#define SVG_MIMETYPES
+#endif
+
+#if defined(HAVE_IMAGE)
+#define IMAGE_MIMETYPES "image/jpeg", "image/png", "image/bmp", "image/tiff", "image/tiff-fx",
+#else
+#define IMAGE_MIMETYPES
+#endif
+
 ZATHURA_PLUGIN_REGISTER_WITH_FUNCTIONS("pdf-mupdf", VERSION_MAJOR, VERSION_MINOR, VERSION_REV,
                                        ZATHURA_PLUGIN_FUNCTIONS({
                                            .document_open            = pdf_document_open,
@@ -36,15 +72,6 @@ ZATHURA_PLUGIN_REGISTER_WITH_FUNCTIONS("pdf-mupdf", VERSION_MAJOR, VERSION_MINOR
                                            .page_export_notes        = pdf_page_export_notes,
                                        }),
                                        ZATHURA_PLUGIN_MIMETYPES({
-                                           PDF_MIMETYPE "application/oxps",
-                                           "application/epub+zip",
-                                           "application/x-fictionbook",
-                                           "application/x-mobipocket-ebook",
-                                           "text/xml",
-                                           "image/svg+xml",
-                                           "image/jpeg",
-                                           "image/png",
-                                           "image/bmp",
-                                           "image/tiff",
-                                           "image/tiff-fx",
+                                           PDF_MIMETYPE XPS_MIMETYPES EPUB_MIMETYPES FB2_MIMETYPES MOBI_MIMETYPES
+                                               SVG_MIMETYPES IMAGE_MIMETYPES
                                        }))
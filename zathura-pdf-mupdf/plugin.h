@@ -10,18 +10,74 @@
 #include <mupdf/fitz.h>
 #include <cairo.h>
 
+#include "cache.h"
+#include "prefetch.h"
+#include "raster.h"
+#include "stats.h"
+#include "textindex.h"
+#include "textlines.h"
+#include "watchdog.h"
+
+/* upper bound of mupdf_document_t::render_bands */
+#define RENDER_BANDS_MAX 16
+
 typedef struct mupdf_document_s {
-  fz_context* ctx;       /**< Context */
-  fz_document* document; /**< mupdf document */
-  GMutex mutex;
+  fz_context* ctx;                /**< Base context */
+  fz_document* document;          /**< mupdf document */
+  GMappedFile* mapped;            /**< Mapping the document is read from, NULL unless ZATHURA_MUPDF_MMAP is set */
+  GMutex mutex;                   /**< Serializes access to the document and its pages */
+  GMutex locks[FZ_LOCK_MAX];      /**< Locks handed to mupdf via fz_locks_context */
+  GMutex contexts_mutex;          /**< Guards contexts */
+  GHashTable* contexts;           /**< Set of the per-thread contexts, owned by the threads */
+  size_t memory_budget;           /**< Memory shared by the store and the caches, see ZATHURA_MUPDF_MEMORY */
+  size_t store_budget;            /**< Limit of mupdf's resource store */
+  mupdf_cache_t pages;            /**< LRU of the loaded pages, every page counts as 1 */
+  mupdf_cache_t display_lists;    /**< LRU of the display lists of all pages */
+  mupdf_cache_t texts;            /**< LRU of the extracted text of all pages */
+  mupdf_rasters_t rasters;        /**< Finished renders of recent views, see ZATHURA_MUPDF_RASTER_CACHE */
+  unsigned int tile_size;         /**< Edge length of rendered tiles in pixels, 0 renders the clip at once */
+  unsigned int render_bands;      /**< Maximum number of bands a render is split into */
+  unsigned int band_height;       /**< Minimum height of a band in pixels */
+  unsigned int outline_depth;     /**< Levels of the outline that are indexed, 0 for all */
+  GThreadPool* render_pool;       /**< Workers drawing bands, created on first use; guarded by contexts_mutex */
+  GThreadPool* thumbnail_pool;    /**< Workers drawing thumbnails, created on first use; guarded by contexts_mutex */
+  bool thumbnail_cache;           /**< If thumbnails are cached on disk, see ZATHURA_MUPDF_THUMBNAIL_CACHE */
+  bool incremental_save;          /**< If saves to the source append a revision, see ZATHURA_MUPDF_INCREMENTAL_SAVE */
+  mupdf_text_index_t* text_index; /**< Trigram filters of the page texts, NULL unless enabled */
+  mupdf_watchdog_t* watchdog;     /**< Aborts renders of pages that left the view, NULL if disabled */
+  mupdf_prefetch_t* prefetch;     /**< Prepares the pages ahead of the reading position, NULL if disabled */
+  GPtrArray* attachment_names;    /**< Names of the embedded files, indexed on first use; guarded by mutex */
+  GHashTable* attachments;        /**< Filespecs of the embedded files keyed by name; guarded by mutex */
+  GHashTable* destinations;       /**< Resolved targets of internal links keyed by uri; guarded by mutex */
+  mupdf_stats_t stats;            /**< Instrumentation, see ZATHURA_MUPDF_STATS */
 } mupdf_document_t;
 
+typedef struct mupdf_page_image_s {
+  fz_rect bbox;    /**< Position on the page */
+  fz_image* image; /**< Reference to the image */
+} mupdf_page_image_t;
+
+typedef struct mupdf_page_link_s {
+  zathura_rectangle_t position; /**< Position on the page */
+  zathura_link_type_t type;     /**< Type of the link */
+  zathura_link_target_t target; /**< Resolved target, its value is owned by the link */
+} mupdf_page_link_t;
+
 typedef struct mupdf_page_s {
-  fz_page* page;       /**< Reference to the mupdf page */
-  fz_context* ctx;     /**< Context */
-  fz_stext_page* text; /**< Page text */
-  fz_rect bbox;        /**< Bbox */
-  bool extracted_text; /**< If text has already been extracted */
+  int index;                              /**< Page number */
+  fz_page* page;                          /**< Reference to the mupdf page, loaded on first use */
+  mupdf_cache_entry_t page_entry;         /**< Bookkeeping in mupdf_document_t::pages */
+  fz_stext_page* text;                    /**< Page text, extracted on first use */
+  mupdf_text_lines_t* text_lines;         /**< Lines of text by position, indexed on first use and dropped with text */
+  mupdf_cache_entry_t text_entry;         /**< Bookkeeping in mupdf_document_t::texts */
+  fz_rect bbox;                           /**< Bbox */
+  bool extracted_text;                    /**< If text has already been extracted */
+  GMutex mutex;                           /**< Guards text and display list; taken before the document mutex */
+  fz_display_list* display_list;          /**< Page contents in page space, built on first use */
+  mupdf_cache_entry_t display_list_entry; /**< Bookkeeping in mupdf_document_t::display_lists */
+  GArray* images;                         /**< Images of the page as mupdf_page_image_t, collected on first use */
+  GArray* links;                          /**< Resolved links as mupdf_page_link_t; guarded by the document mutex */
+  GHashTable* annotations;                /**< Grid of notes and markups by position; guarded by the document mutex */
 } mupdf_page_t;
 
 /**
@@ -232,7 +288,8 @@ zathura_error_t pdf_page_delete_note(zathura_page_t* page, void* data, double x,
 zathura_error_t pdf_page_update_note_content(zathura_page_t* page, void* data, double x, double y, const char* content);
 
 /**
- * Exports notes to page as PDF text annotations
+ * Exports notes to page as PDF text annotations. All notes are created in one
+ * undoable operation and their appearances are synthesized together.
  *
  * @param page Page
  * @param data Mupdf page representation
@@ -253,7 +310,9 @@ zathura_error_t pdf_page_export_notes(zathura_page_t* page, void* data, girara_l
 girara_list_t* pdf_page_get_annotations(zathura_page_t* page, void* data, zathura_error_t* error);
 
 /**
- * Exports zathura highlights as embedded PDF annotations
+ * Exports the zathura highlights of page as embedded PDF annotations. They are
+ * created in one undoable operation and their appearances are synthesized
+ * together; highlights of other pages are skipped.
  *
  * @param page Page
  * @param data Mupdf page representation
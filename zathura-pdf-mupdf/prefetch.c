@@ -0,0 +1,191 @@
+/* SPDX-License-Identifier: Zlib */
+
+#include <stdlib.h>
+
+#include "alloc.h"
+#include "plugin.h"
+#include "prefetch.h"
+#include "utils.h"
+
+typedef struct mupdf_prefetch_task_s {
+  mupdf_page_t* mupdf_page;
+  unsigned int generation; /**< Generation the task was scheduled in */
+} mupdf_prefetch_task_t;
+
+static void mupdf_prefetch_prepare(mupdf_prefetch_t* prefetch, mupdf_page_t* mupdf_page, fz_cookie* cookie) {
+  mupdf_document_t* mupdf_document = prefetch->mupdf_document;
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    return;
+  }
+
+  /* prefetched lists would only push others out of the caches once the budget is used up */
+  if (mupdf_alloc_in_use() >= mupdf_document->memory_budget) {
+    return;
+  }
+
+  /* a page whose mutex is taken is being rendered and builds its display list itself */
+  if (g_mutex_trylock(&mupdf_page->mutex) == FALSE) {
+    return;
+  }
+
+  fz_drop_display_list(ctx, mupdf_page_get_display_list(mupdf_document, mupdf_page, ctx, cookie));
+  if (prefetch->text == true && cookie->abort == 0) {
+    mupdf_page_get_text(mupdf_document, mupdf_page);
+  }
+  g_mutex_unlock(&mupdf_page->mutex);
+}
+
+static void mupdf_prefetch_worker(gpointer data, gpointer user_data) {
+  mupdf_prefetch_task_t* task = data;
+  mupdf_prefetch_t* prefetch  = user_data;
+  fz_cookie cookie            = {0};
+
+  /* tasks of an older generation may belong to pages that are freed already */
+  g_mutex_lock(&prefetch->mutex);
+  const bool current = task->generation == prefetch->generation;
+  if (current == true) {
+    g_ptr_array_add(prefetch->running, &cookie);
+  }
+  g_mutex_unlock(&prefetch->mutex);
+
+  if (current == true) {
+    mupdf_prefetch_prepare(prefetch, task->mupdf_page, &cookie);
+
+    g_mutex_lock(&prefetch->mutex);
+    g_ptr_array_remove_fast(prefetch->running, &cookie);
+    g_cond_broadcast(&prefetch->cond);
+    g_mutex_unlock(&prefetch->mutex);
+  }
+
+  g_free(task);
+}
+
+/* skips the scheduled tasks and aborts the running ones, called with the mutex held */
+static void mupdf_prefetch_abort(mupdf_prefetch_t* prefetch) {
+  prefetch->generation++;
+  for (guint i = 0; i < prefetch->running->len; i++) {
+    fz_cookie* cookie = g_ptr_array_index(prefetch->running, i);
+    cookie->abort     = 1;
+  }
+}
+
+mupdf_prefetch_t* mupdf_prefetch_new(mupdf_document_t* mupdf_document, unsigned int pages, bool text) {
+  mupdf_prefetch_t* prefetch = g_malloc0(sizeof(mupdf_prefetch_t));
+
+  prefetch->mupdf_document = mupdf_document;
+  prefetch->pages          = pages;
+  prefetch->text           = text;
+  prefetch->last_page      = -1;
+  prefetch->direction      = 1;
+  prefetch->running        = g_ptr_array_new();
+  g_mutex_init(&prefetch->mutex);
+  g_cond_init(&prefetch->cond);
+
+  return prefetch;
+}
+
+void mupdf_prefetch_free(mupdf_prefetch_t* prefetch) {
+  if (prefetch == NULL) {
+    return;
+  }
+
+  /* the remaining tasks are stale and only freed by the worker */
+  mupdf_prefetch_cancel(prefetch);
+  if (prefetch->pool != NULL) {
+    g_thread_pool_free(prefetch->pool, FALSE, TRUE);
+  }
+
+  g_ptr_array_free(prefetch->running, TRUE);
+  g_cond_clear(&prefetch->cond);
+  g_mutex_clear(&prefetch->mutex);
+  g_free(prefetch);
+}
+
+void mupdf_prefetch_cancel(mupdf_prefetch_t* prefetch) {
+  if (prefetch == NULL) {
+    return;
+  }
+
+  g_mutex_lock(&prefetch->mutex);
+  mupdf_prefetch_abort(prefetch);
+  while (prefetch->running->len > 0) {
+    g_cond_wait(&prefetch->cond, &prefetch->mutex);
+  }
+  prefetch->last_page = -1;
+  g_mutex_unlock(&prefetch->mutex);
+}
+
+void mupdf_prefetch_yield(mupdf_prefetch_t* prefetch) {
+  if (prefetch == NULL) {
+    return;
+  }
+
+  /* scheduled tasks only take the document mutex once the running one released it */
+  g_mutex_lock(&prefetch->mutex);
+  if (prefetch->running->len > 0) {
+    mupdf_prefetch_abort(prefetch);
+    prefetch->last_page = -1;
+  }
+  g_mutex_unlock(&prefetch->mutex);
+}
+
+void mupdf_prefetch_page_rendered(mupdf_prefetch_t* prefetch, zathura_document_t* document, unsigned int index) {
+  if (prefetch == NULL || document == NULL) {
+    return;
+  }
+
+  const int page    = index;
+  const int n_pages = zathura_document_get_number_of_pages(document);
+
+  g_mutex_lock(&prefetch->mutex);
+  if (prefetch->last_page < 0) {
+    prefetch->scheduled = page;
+  } else if (page != prefetch->last_page) {
+    const int direction = page > prefetch->last_page ? 1 : -1;
+    if (abs(page - prefetch->last_page) > (int)prefetch->pages + 1) {
+      /* the user jumped, the pages around the old position are not needed anymore */
+      mupdf_prefetch_abort(prefetch);
+      prefetch->scheduled = page;
+    } else if (direction != prefetch->direction) {
+      /* the scheduled pages lie behind the reader now */
+      prefetch->generation++;
+      prefetch->scheduled = page;
+    }
+    prefetch->direction = direction;
+  }
+  prefetch->last_page = page;
+
+  if (prefetch->pool == NULL) {
+    /* the thread is exclusive, so that its context lives as long as the pool */
+    prefetch->pool = g_thread_pool_new(mupdf_prefetch_worker, prefetch, 1, TRUE, NULL);
+  }
+
+  /* pages that are scheduled already are not scheduled again */
+  const int direction = prefetch->direction;
+  for (unsigned int i = 1; i <= prefetch->pages && prefetch->pool != NULL; i++) {
+    const int target = page + direction * (int)i;
+    if (target < 0 || target >= n_pages) {
+      break;
+    }
+    if ((target - prefetch->scheduled) * direction <= 0) {
+      continue;
+    }
+
+    zathura_page_t* zathura_page = zathura_document_get_page(document, target);
+    mupdf_page_t* mupdf_page     = zathura_page != NULL ? zathura_page_get_data(zathura_page) : NULL;
+    if (mupdf_page == NULL) {
+      break;
+    }
+
+    mupdf_prefetch_task_t* task = g_malloc(sizeof(mupdf_prefetch_task_t));
+    task->mupdf_page            = mupdf_page;
+    task->generation            = prefetch->generation;
+    if (g_thread_pool_push(prefetch->pool, task, NULL) == FALSE) {
+      g_free(task);
+      break;
+    }
+    prefetch->scheduled = target;
+  }
+  g_mutex_unlock(&prefetch->mutex);
+}
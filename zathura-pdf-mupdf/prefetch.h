@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: Zlib */
+
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdbool.h>
+#include <glib.h>
+#include <mupdf/fitz.h>
+#include <zathura/plugin-api.h>
+
+typedef struct mupdf_document_s mupdf_document_t;
+
+typedef struct mupdf_prefetch_s {
+  mupdf_document_t* mupdf_document; /**< Document whose pages are prefetched */
+  unsigned int pages;               /**< Number of pages prepared ahead of the reading position */
+  bool text;                        /**< If the text of the pages is extracted as well */
+  GMutex mutex;                     /**< Guards the fields below */
+  GCond cond;                       /**< Signalled when a running task finishes */
+  GThreadPool* pool;                /**< Worker preparing the pages, started with the first task */
+  unsigned int generation;          /**< Bumped on every jump, tasks of older generations are skipped */
+  int last_page;                    /**< Page rendered last, -1 before the first render */
+  int direction;                    /**< 1 while reading forward, -1 while reading backward */
+  int scheduled;                    /**< Furthest page scheduled in the reading direction */
+  GPtrArray* running;               /**< Cookies of the running tasks, aborted on a jump */
+} mupdf_prefetch_t;
+
+/**
+ * Creates a prefetcher that builds the display lists of the pages following
+ * the reading position on an idle worker thread
+ *
+ * @param mupdf_document Mupdf document
+ * @param pages Number of pages prepared ahead
+ * @param text If the text of the pages is extracted as well
+ * @return The prefetcher
+ */
+mupdf_prefetch_t* mupdf_prefetch_new(mupdf_document_t* mupdf_document, unsigned int pages, bool text);
+
+/**
+ * Cancels all tasks and frees the prefetcher
+ *
+ * @param prefetch The prefetcher
+ */
+void mupdf_prefetch_free(mupdf_prefetch_t* prefetch);
+
+/**
+ * Moves the reading position to a page that was rendered. The pages ahead in
+ * the reading direction are scheduled; if the position jumped further than
+ * the prepared pages reach, the tasks of the old position are cancelled.
+ *
+ * @param prefetch The prefetcher
+ * @param document Zathura document
+ * @param index Page that was rendered
+ */
+void mupdf_prefetch_page_rendered(mupdf_prefetch_t* prefetch, zathura_document_t* document, unsigned int index);
+
+/**
+ * Makes way for a render that has to interpret its page. A running task holds
+ * the document mutex while it interprets, so it is aborted together with the
+ * scheduled ones; the pages are scheduled again after the next render.
+ * Returns without waiting for the running task.
+ *
+ * @param prefetch The prefetcher
+ */
+void mupdf_prefetch_yield(mupdf_prefetch_t* prefetch);
+
+/**
+ * Cancels all scheduled tasks and waits for the running ones, so that no page
+ * is used by the prefetcher anymore
+ *
+ * @param prefetch The prefetcher
+ */
+void mupdf_prefetch_cancel(mupdf_prefetch_t* prefetch);
+
+#endif // PREFETCH_H
@@ -0,0 +1,223 @@
+/* SPDX-License-Identifier: Zlib */
+
+#include <string.h>
+
+#include "raster.h"
+
+/* the header word of a run of one repeated pixel, the others are followed by that many literal pixels */
+#define RASTER_RUN ((guint32)1 << 31)
+/* shorter runs are cheaper as literals */
+#define RASTER_MIN_RUN 3
+
+typedef struct mupdf_raster_s {
+  mupdf_raster_key_t key;
+  mupdf_cache_entry_t entry;
+  guint32* data; /**< Encoded rows */
+  size_t length; /**< Number of words in data */
+} mupdf_raster_t;
+
+static guint mupdf_raster_key_hash(gconstpointer data) {
+  const mupdf_raster_key_t* key = data;
+
+  guint hash = g_int_hash(&key->page);
+  hash       = hash * 31 + g_double_hash(&key->scalex);
+  hash       = hash * 31 + g_double_hash(&key->scaley);
+  hash       = hash * 31 + (guint)key->area.x0;
+  hash       = hash * 31 + (guint)key->area.y0;
+  hash       = hash * 31 + (guint)key->area.x1;
+  hash       = hash * 31 + (guint)key->area.y1;
+
+  return hash * 31 + (guint)key->aa_level;
+}
+
+static gboolean mupdf_raster_key_equal(gconstpointer a, gconstpointer b) {
+  const mupdf_raster_key_t* key_a = a;
+  const mupdf_raster_key_t* key_b = b;
+
+  return key_a->page == key_b->page && key_a->scalex == key_b->scalex && key_a->scaley == key_b->scaley &&
+         key_a->area.x0 == key_b->area.x0 && key_a->area.y0 == key_b->area.y0 && key_a->area.x1 == key_b->area.x1 &&
+         key_a->area.y1 == key_b->area.y1 && key_a->aa_level == key_b->aa_level;
+}
+
+static void mupdf_raster_free(gpointer data) {
+  mupdf_raster_t* raster = data;
+
+  g_free(raster->data);
+  g_free(raster);
+}
+
+static void mupdf_raster_encode_row(GArray* words, const guint32* row, int width) {
+  for (int x = 0; x < width;) {
+    int run = 1;
+    while (x + run < width && row[x + run] == row[x]) {
+      run++;
+    }
+
+    if (run >= RASTER_MIN_RUN) {
+      const guint32 header = RASTER_RUN | (guint32)run;
+      g_array_append_val(words, header);
+      g_array_append_val(words, row[x]);
+      x += run;
+      continue;
+    }
+
+    /* the literals reach up to the next run */
+    int end = x + run;
+    while (end < width) {
+      run = 1;
+      while (end + run < width && run < RASTER_MIN_RUN && row[end + run] == row[end]) {
+        run++;
+      }
+      if (run >= RASTER_MIN_RUN) {
+        break;
+      }
+      end += run;
+    }
+
+    const guint32 header = (guint32)(end - x);
+    g_array_append_val(words, header);
+    g_array_append_vals(words, row + x, end - x);
+    x = end;
+  }
+}
+
+static const guint32* mupdf_raster_decode_row(const guint32* words, guint32* row, int width) {
+  for (int x = 0; x < width;) {
+    const guint32 header = *words++;
+    const int length     = header & ~RASTER_RUN;
+
+    if ((header & RASTER_RUN) != 0) {
+      const guint32 pixel = *words++;
+      for (int i = 0; i < length; i++) {
+        row[x + i] = pixel;
+      }
+    } else {
+      memcpy(row + x, words, (size_t)length * sizeof(guint32));
+      words += length;
+    }
+    x += length;
+  }
+
+  return words;
+}
+
+/* called with the mutex of the raster cache held, the entry is freed after the cache was unlocked */
+static bool mupdf_raster_evict(void* data, mupdf_cache_entry_t* entry) {
+  mupdf_rasters_t* rasters = data;
+  mupdf_raster_t* raster   = mupdf_cache_entry_owner(entry, mupdf_raster_t, entry);
+
+  g_hash_table_steal(rasters->entries, &raster->key);
+  rasters->evicted = g_slist_prepend(rasters->evicted, raster);
+
+  return true;
+}
+
+void mupdf_rasters_init(mupdf_rasters_t* rasters, size_t budget) {
+  g_mutex_init(&rasters->mutex);
+  rasters->entries = g_hash_table_new_full(mupdf_raster_key_hash, mupdf_raster_key_equal, NULL, mupdf_raster_free);
+  mupdf_cache_init(&rasters->cache, budget, mupdf_raster_evict);
+  rasters->generation = 0;
+  rasters->evicted    = NULL;
+}
+
+void mupdf_rasters_clear(mupdf_rasters_t* rasters) {
+  g_hash_table_unref(rasters->entries);
+  mupdf_cache_clear(&rasters->cache);
+  g_mutex_clear(&rasters->mutex);
+}
+
+guint64 mupdf_rasters_generation(mupdf_rasters_t* rasters) {
+  g_mutex_lock(&rasters->mutex);
+  const guint64 generation = rasters->generation;
+  g_mutex_unlock(&rasters->mutex);
+
+  return generation;
+}
+
+bool mupdf_rasters_lookup(mupdf_rasters_t* rasters, const mupdf_raster_key_t* key, unsigned char* image,
+                          int rowstride) {
+  if (rasters->cache.budget == 0) {
+    return false;
+  }
+
+  g_mutex_lock(&rasters->mutex);
+  mupdf_raster_t* raster = g_hash_table_lookup(rasters->entries, key);
+  if (raster != NULL) {
+    const int width      = key->area.x1 - key->area.x0;
+    const guint32* words = raster->data;
+    for (int y = key->area.y0; y < key->area.y1; y++) {
+      guint32* row = (guint32*)(image + (ptrdiff_t)y * rowstride + (ptrdiff_t)key->area.x0 * 4);
+      words        = mupdf_raster_decode_row(words, row, width);
+    }
+    mupdf_cache_touch(&rasters->cache, &raster->entry);
+  }
+  g_mutex_unlock(&rasters->mutex);
+
+  return raster != NULL;
+}
+
+void mupdf_rasters_insert(mupdf_rasters_t* rasters, const mupdf_raster_key_t* key, guint64 generation,
+                          const unsigned char* image, int rowstride) {
+  if (rasters->cache.budget == 0) {
+    return;
+  }
+
+  /* encoding happens outside the lock, a page is mostly runs of its background */
+  const int width = key->area.x1 - key->area.x0;
+  GArray* words   = g_array_new(FALSE, FALSE, sizeof(guint32));
+  for (int y = key->area.y0; y < key->area.y1; y++) {
+    const guint32* row = (const guint32*)(image + (ptrdiff_t)y * rowstride + (ptrdiff_t)key->area.x0 * 4);
+    mupdf_raster_encode_row(words, row, width);
+  }
+
+  mupdf_raster_t* raster = g_malloc0(sizeof(mupdf_raster_t));
+  raster->key            = *key;
+  raster->length         = words->len;
+  raster->data           = (guint32*)g_array_free(words, FALSE);
+
+  const size_t size = sizeof(mupdf_raster_t) + raster->length * sizeof(guint32);
+
+  g_mutex_lock(&rasters->mutex);
+  /* a raster larger than the whole budget would evict everything else */
+  if (generation != rasters->generation || size > rasters->cache.budget ||
+      g_hash_table_contains(rasters->entries, key) == TRUE) {
+    g_mutex_unlock(&rasters->mutex);
+    mupdf_raster_free(raster);
+    return;
+  }
+
+  g_hash_table_insert(rasters->entries, &raster->key, raster);
+  mupdf_cache_insert(&rasters->cache, &raster->entry, size, rasters);
+  GSList* evicted  = rasters->evicted;
+  rasters->evicted = NULL;
+  g_mutex_unlock(&rasters->mutex);
+
+  g_slist_free_full(evicted, mupdf_raster_free);
+}
+
+typedef struct mupdf_raster_page_s {
+  mupdf_rasters_t* rasters;
+  int page;
+} mupdf_raster_page_t;
+
+static gboolean mupdf_raster_is_of_page(gpointer key, gpointer value, gpointer user_data) {
+  const mupdf_raster_key_t* raster_key = key;
+  mupdf_raster_t* raster               = value;
+  mupdf_raster_page_t* page            = user_data;
+
+  if (raster_key->page != page->page) {
+    return FALSE;
+  }
+
+  mupdf_cache_remove(&page->rasters->cache, &raster->entry);
+  return TRUE;
+}
+
+void mupdf_rasters_invalidate(mupdf_rasters_t* rasters, int page) {
+  mupdf_raster_page_t data = {.rasters = rasters, .page = page};
+
+  g_mutex_lock(&rasters->mutex);
+  rasters->generation++;
+  g_hash_table_foreach_remove(rasters->entries, mupdf_raster_is_of_page, &data);
+  g_mutex_unlock(&rasters->mutex);
+}
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: Zlib */
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stdbool.h>
+#include <glib.h>
+#include <mupdf/fitz.h>
+
+#include "cache.h"
+
+typedef struct mupdf_raster_key_s {
+  int page;      /**< Index of the page */
+  double scalex; /**< Horizontal scale of the render */
+  double scaley; /**< Vertical scale of the render */
+  fz_irect area; /**< Area of the scaled page that was rendered */
+  int aa_level;  /**< Anti-aliasing bits or -1 for the context's level */
+} mupdf_raster_key_t;
+
+typedef struct mupdf_rasters_s {
+  GMutex mutex;        /**< Guards entries and generation, taken before the mutex of cache */
+  GHashTable* entries; /**< Run-length encoded rasters keyed by mupdf_raster_key_t */
+  mupdf_cache_t cache; /**< LRU of the entries, accounted by their encoded size */
+  guint64 generation;  /**< Bumped whenever a page changes, renders started before are not kept */
+  GSList* evicted;     /**< Entries evicted during an insert, freed once the cache is unlocked */
+} mupdf_rasters_t;
+
+/**
+ * Initializes a raster cache
+ *
+ * @param rasters The raster cache
+ * @param budget Memory budget of the encoded rasters, 0 disables the cache
+ */
+void mupdf_rasters_init(mupdf_rasters_t* rasters, size_t budget);
+
+/**
+ * Frees all rasters and clears the cache
+ *
+ * @param rasters The raster cache
+ */
+void mupdf_rasters_clear(mupdf_rasters_t* rasters);
+
+/**
+ * Returns the current generation, to be passed to mupdf_rasters_insert after
+ * the render
+ *
+ * @param rasters The raster cache
+ * @return The generation
+ */
+guint64 mupdf_rasters_generation(mupdf_rasters_t* rasters);
+
+/**
+ * Copies a cached raster into a buffer in cairo's CAIRO_FORMAT_RGB24 layout
+ *
+ * @param rasters The raster cache
+ * @param key Page, scale and area of the render
+ * @param image The buffer, its origin is the origin of the scaled page
+ * @param rowstride Bytes per row of the buffer
+ * @return true if the area was copied, false if it is not cached
+ */
+bool mupdf_rasters_lookup(mupdf_rasters_t* rasters, const mupdf_raster_key_t* key, unsigned char* image,
+                          int rowstride);
+
+/**
+ * Encodes a finished render and adds it to the cache, evicting the least
+ * recently used rasters
+ *
+ * @param rasters The raster cache
+ * @param key Page, scale and area of the render
+ * @param generation Generation read before the render started; if a page
+ *   changed since, the raster is dropped
+ * @param image The buffer the area was rendered into
+ * @param rowstride Bytes per row of the buffer
+ */
+void mupdf_rasters_insert(mupdf_rasters_t* rasters, const mupdf_raster_key_t* key, guint64 generation,
+                          const unsigned char* image, int rowstride);
+
+/**
+ * Drops all rasters of a page whose contents changed
+ *
+ * @param rasters The raster cache
+ * @param page Index of the page
+ */
+void mupdf_rasters_invalidate(mupdf_rasters_t* rasters, int page);
+
+#endif // RASTER_H
@@ -1,58 +1,265 @@
 /* SPDX-License-Identifier: Zlib */
 
+#include <limits.h>
 #include <glib.h>
 
 #include "plugin.h"
+#include "render.h"
+#include "utils.h"
 
-static zathura_error_t pdf_page_render_to_buffer(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
-                                                 unsigned char* image, int GIRARA_UNUSED(rowstride),
-                                                 int GIRARA_UNUSED(components), unsigned int page_width,
-                                                 unsigned int page_height, double scalex, double scaley) {
-  if (mupdf_document == NULL || mupdf_document->ctx == NULL || mupdf_page == NULL || mupdf_page->page == NULL ||
-      image == NULL) {
+/* anti-aliasing bits of previews */
+#define PREVIEW_AA_LEVEL 0
+/* smaller areas are drawn in one piece, splitting them costs more in synchronisation than it saves */
+#define RENDER_BAND_MIN_PIXELS (1 << 20)
+
+static void pdf_page_render_area(fz_context* ctx, fz_display_list* display_list, fz_matrix ctm, unsigned char* image,
+                                 int rowstride, fz_irect area, fz_cookie* cookie) {
+  fz_pixmap* volatile pixmap      = NULL;
+  fz_device* volatile draw_device = NULL;
+
+  fz_try(ctx) {
+    /* the pixmap is a view on the area inside the target buffer */
+    unsigned char* samples = image + (ptrdiff_t)area.y0 * rowstride + (ptrdiff_t)area.x0 * 4;
+    /* TODO: What are separations used for? */
+    pixmap    = fz_new_pixmap_with_data(ctx, fz_device_bgr(ctx), area.x1 - area.x0, area.y1 - area.y0, NULL, 1,
+                                        rowstride, samples);
+    pixmap->x = area.x0;
+    pixmap->y = area.y0;
+    fz_clear_pixmap_with_value(ctx, pixmap, 0xFF);
+
+    draw_device = fz_new_draw_device(ctx, fz_identity, pixmap);
+    fz_run_display_list(ctx, display_list, draw_device, ctm, fz_rect_from_irect(area), cookie);
+    fz_close_device(ctx, draw_device);
+  }
+  fz_always(ctx) {
+    fz_drop_device(ctx, draw_device);
+    fz_drop_pixmap(ctx, pixmap);
+  }
+  fz_catch(ctx) {
+    fz_rethrow(ctx);
+  }
+}
+
+static void pdf_page_render_tiles(fz_context* ctx, fz_display_list* display_list, fz_matrix ctm, unsigned char* image,
+                                  int rowstride, fz_irect area, unsigned int tile_size, fz_cookie* cookie) {
+  int size = tile_size > 0 ? (int)tile_size : INT_MAX;
+
+  for (int y = area.y0; y < area.y1; y += MIN(size, area.y1 - y)) {
+    for (int x = area.x0; x < area.x1; x += MIN(size, area.x1 - x)) {
+      fz_irect tile = {x, y, x + MIN(size, area.x1 - x), y + MIN(size, area.y1 - y)};
+      if (cookie->abort != 0) {
+        return;
+      }
+      pdf_page_render_area(ctx, display_list, ctm, image, rowstride, tile, cookie);
+    }
+  }
+}
+
+typedef struct render_job_s {
+  mupdf_document_t* mupdf_document;
+  fz_display_list* display_list;
+  fz_matrix ctm;
+  unsigned char* image;
+  int rowstride;
+  GMutex mutex;
+  GCond cond;
+  unsigned int pending; /**< Bands not yet rendered */
+  bool failed;
+  int aa_level;                        /**< Anti-aliasing bits of the bands, -1 keeps the context's level */
+  fz_cookie cookies[RENDER_BANDS_MAX]; /**< One per band, mupdf cookies are not shared between threads */
+} render_job_t;
+
+typedef struct render_band_s {
+  render_job_t* job;
+  fz_irect area;
+  fz_cookie* cookie;
+} render_band_t;
+
+static bool pdf_page_render_band(render_band_t* band) {
+  render_job_t* job = band->job;
+  fz_context* ctx   = mupdf_document_get_context(job->mupdf_document);
+  if (ctx == NULL) {
+    return false;
+  }
+
+  /* the level is a setting of the thread's own context, it is restored for the next render */
+  const int text_aa_level     = fz_text_aa_level(ctx);
+  const int graphics_aa_level = fz_graphics_aa_level(ctx);
+  if (job->aa_level >= 0) {
+    fz_set_aa_level(ctx, job->aa_level);
+  }
+
+  bool success = true;
+  fz_try(ctx) {
+    pdf_page_render_tiles(ctx, job->display_list, job->ctm, job->image, job->rowstride, band->area,
+                          job->mupdf_document->tile_size, band->cookie);
+  }
+  fz_catch(ctx) {
+    success = false;
+  }
+
+  if (job->aa_level >= 0) {
+    fz_set_text_aa_level(ctx, text_aa_level);
+    fz_set_graphics_aa_level(ctx, graphics_aa_level);
+  }
+
+  /* an aborted band is incomplete */
+  if (band->cookie->abort != 0) {
+    success = false;
+  }
+
+  return success;
+}
+
+static void pdf_page_render_band_worker(gpointer data, gpointer GIRARA_UNUSED(user_data)) {
+  render_band_t* band = data;
+  render_job_t* job   = band->job;
+
+  bool success = pdf_page_render_band(band);
+
+  g_mutex_lock(&job->mutex);
+  if (success == false) {
+    job->failed = true;
+  }
+  job->pending--;
+  g_cond_signal(&job->cond);
+  g_mutex_unlock(&job->mutex);
+}
+
+static unsigned int pdf_page_render_band_count(mupdf_document_t* mupdf_document, fz_irect area) {
+  if (mupdf_document->render_bands <= 1 || mupdf_document->band_height == 0) {
+    return 1;
+  }
+
+  const unsigned int width  = area.x1 - area.x0;
+  const unsigned int height = area.y1 - area.y0;
+  if (height / 2 < mupdf_document->band_height || (guint64)width * height < RENDER_BAND_MIN_PIXELS) {
+    return 1;
+  }
+
+  /* rounding down keeps every band at least band_height rows high */
+  const unsigned int bands = MIN(height / mupdf_document->band_height, mupdf_document->render_bands);
+
+  g_mutex_lock(&mupdf_document->contexts_mutex);
+  if (mupdf_document->render_pool == NULL) {
+    /* the calling thread draws one band itself */
+    mupdf_document->render_pool =
+        g_thread_pool_new(pdf_page_render_band_worker, NULL, mupdf_document->render_bands - 1, FALSE, NULL);
+  }
+  g_mutex_unlock(&mupdf_document->contexts_mutex);
+
+  return mupdf_document->render_pool != NULL ? bands : 1;
+}
+
+zathura_error_t mupdf_page_render_to_buffer(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+                                            zathura_page_t* watched, unsigned char* image, int rowstride,
+                                            fz_irect area, double scalex, double scaley, int aa_level) {
+  if (mupdf_document == NULL || mupdf_document->ctx == NULL || mupdf_page == NULL || image == NULL) {
     return ZATHURA_ERROR_UNKNOWN;
   }
 
-  g_mutex_lock(&mupdf_document->mutex);
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
 
-  fz_display_list* display_list = fz_new_display_list(mupdf_page->ctx, (fz_rect){.x1 = page_width, .y1 = page_height});
-  fz_device* device             = fz_new_list_device(mupdf_page->ctx, display_list);
+  render_job_t job = {
+      .mupdf_document = mupdf_document,
+      .ctm            = fz_scale(scalex, scaley),
+      .image          = image,
+      .rowstride      = rowstride,
+      .pending        = 0,
+      .failed         = false,
+      .aa_level       = aa_level,
+  };
 
-  fz_try(mupdf_document->ctx) {
-    fz_matrix m;
-    m = fz_scale(scalex, scaley);
-    fz_run_page(mupdf_document->ctx, mupdf_page->page, device, m, NULL);
+  /* renders of pages that leave the view are aborted, both while interpreting and while drawing */
+  mupdf_watch_t watch = {.page = watched, .cookies = job.cookies, .n_cookies = RENDER_BANDS_MAX};
+  if (watched != NULL && mupdf_document->watchdog != NULL) {
+    mupdf_watchdog_add(mupdf_document->watchdog, &watch);
   }
-  fz_always(mupdf_document->ctx) {
-    fz_close_device(mupdf_page->ctx, device);
-    fz_drop_device(mupdf_page->ctx, device);
+
+  /* the display list is built once in page space and replayed at every scale */
+  g_mutex_lock(&mupdf_page->mutex);
+  if (mupdf_page->display_list == NULL) {
+    /* the page on screen does not wait for the prefetcher to release the document mutex */
+    mupdf_prefetch_yield(mupdf_document->prefetch);
   }
-  fz_catch(mupdf_document->ctx) {
-    fz_drop_display_list(mupdf_page->ctx, display_list);
-    g_mutex_unlock(&mupdf_document->mutex);
+  job.display_list = mupdf_page_get_display_list(mupdf_document, mupdf_page, ctx, &job.cookies[0]);
+  g_mutex_unlock(&mupdf_page->mutex);
+
+  if (job.display_list == NULL) {
+    if (watched != NULL && mupdf_document->watchdog != NULL) {
+      mupdf_watchdog_remove(mupdf_document->watchdog, &watch);
+    }
     return ZATHURA_ERROR_UNKNOWN;
   }
 
-  fz_colorspace* colorspace = fz_device_bgr(mupdf_document->ctx);
-  /* TODO: What are separations used for? */
-  fz_pixmap* pixmap = fz_new_pixmap_with_bbox_and_data(mupdf_page->ctx, colorspace,
-                                                       (fz_irect){.x1 = page_width, .y1 = page_height}, NULL, 1, image);
-  fz_clear_pixmap_with_value(mupdf_page->ctx, pixmap, 0xFF);
+  /* rasterize the display list without holding the document mutex; large areas are split into horizontal bands
+   * that share the display list and are drawn in parallel on the render pool */
+  g_mutex_init(&job.mutex);
+  g_cond_init(&job.cond);
+
+  gint64 start = mupdf_stats_start(&mupdf_document->stats);
+
+  render_band_t bands[RENDER_BANDS_MAX];
+  unsigned int n_bands = pdf_page_render_band_count(mupdf_document, area);
+  int band_height      = (area.y1 - area.y0 + (int)n_bands - 1) / (int)n_bands;
+
+  for (unsigned int i = 0; i < n_bands; i++) {
+    bands[i].job     = &job;
+    bands[i].cookie  = &job.cookies[i];
+    bands[i].area    = area;
+    bands[i].area.y0 = area.y0 + (int)i * band_height;
+    bands[i].area.y1 = MIN(area.y1, bands[i].area.y0 + band_height);
+  }
+
+  /* the calling thread draws the first band itself */
+  for (unsigned int i = 1; i < n_bands; i++) {
+    g_mutex_lock(&job.mutex);
+    job.pending++;
+    g_mutex_unlock(&job.mutex);
+
+    if (g_thread_pool_push(mupdf_document->render_pool, &bands[i], NULL) == FALSE) {
+      g_mutex_lock(&job.mutex);
+      job.pending--;
+      g_mutex_unlock(&job.mutex);
+
+      /* the bands pushed before may fail concurrently */
+      bool band_success = pdf_page_render_band(&bands[i]);
+      g_mutex_lock(&job.mutex);
+      if (band_success == false) {
+        job.failed = true;
+      }
+      g_mutex_unlock(&job.mutex);
+    }
+  }
+
+  bool success = pdf_page_render_band(&bands[0]);
+
+  g_mutex_lock(&job.mutex);
+  while (job.pending > 0) {
+    g_cond_wait(&job.cond, &job.mutex);
+  }
+  if (success == false) {
+    job.failed = true;
+  }
+  g_mutex_unlock(&job.mutex);
+  mupdf_stats_stop(&mupdf_document->stats, MUPDF_STATS_RASTER, start);
 
-  device = fz_new_draw_device(mupdf_page->ctx, fz_identity, pixmap);
-  fz_run_display_list(mupdf_page->ctx, display_list, device, fz_identity,
-                      (fz_rect){.x1 = page_width, .y1 = page_height}, NULL);
-  fz_close_device(mupdf_page->ctx, device);
-  fz_drop_device(mupdf_page->ctx, device);
+  g_cond_clear(&job.cond);
+  g_mutex_clear(&job.mutex);
+  fz_drop_display_list(ctx, job.display_list);
 
-  fz_drop_pixmap(mupdf_page->ctx, pixmap);
-  fz_drop_display_list(mupdf_page->ctx, display_list);
+  if (watched != NULL && mupdf_document->watchdog != NULL &&
+      mupdf_watchdog_remove(mupdf_document->watchdog, &watch) == true) {
+    g_debug("aborted render of page %d", mupdf_page->index);
+  }
 
-  g_mutex_unlock(&mupdf_document->mutex);
-  return ZATHURA_ERROR_OK;
+  return job.failed == true ? ZATHURA_ERROR_UNKNOWN : ZATHURA_ERROR_OK;
 }
 
-zathura_error_t pdf_page_render_cairo(zathura_page_t* page, void* data, cairo_t* cairo, bool GIRARA_UNUSED(printing)) {
+zathura_error_t pdf_page_render_cairo(zathura_page_t* page, void* data, cairo_t* cairo, bool printing) {
   mupdf_page_t* mupdf_page = data;
 
   if (page == NULL || mupdf_page == NULL) {
@@ -76,11 +283,102 @@ zathura_error_t pdf_page_render_cairo(zathura_page_t* page, void* data, cairo_t*
   double scalex = ((double)page_width) / zathura_page_get_width(page);
   double scaley = ((double)page_height) / zathura_page_get_height(page);
 
+  /* only the part of the surface inside the clip is rendered */
+  double x1, y1, x2, y2;
+  cairo_clip_extents(cairo, &x1, &y1, &x2, &y2);
+  cairo_user_to_device(cairo, &x1, &y1);
+  cairo_user_to_device(cairo, &x2, &y2);
+
+  fz_irect area = fz_irect_from_rect(fz_make_rect(MIN(x1, x2), MIN(y1, y2), MAX(x1, x2), MAX(y1, y2)));
+  area          = fz_intersect_irect(area, fz_make_irect(0, 0, page_width, page_height));
+  if (fz_is_empty_irect(area)) {
+    return ZATHURA_ERROR_OK;
+  }
+
   int rowstride        = cairo_image_surface_get_stride(surface);
   unsigned char* image = cairo_image_surface_get_data(surface);
 
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
 
-  return pdf_page_render_to_buffer(mupdf_document, mupdf_page, image, rowstride, 4, page_width, page_height, scalex,
-                                   scaley);
+  /* views that were shown before are copied from the raster cache instead of being drawn again */
+  const mupdf_raster_key_t key = {
+      .page = mupdf_page->index, .scalex = scalex, .scaley = scaley, .area = area, .aa_level = -1};
+  const guint64 generation = mupdf_rasters_generation(&mupdf_document->rasters);
+
+  cairo_surface_flush(surface);
+  zathura_error_t error = ZATHURA_ERROR_OK;
+  if (mupdf_rasters_lookup(&mupdf_document->rasters, &key, image, rowstride) == false) {
+    error = mupdf_page_render_to_buffer(mupdf_document, mupdf_page, printing == false ? page : NULL, image, rowstride,
+                                        area, scalex, scaley, -1);
+    if (error == ZATHURA_ERROR_OK) {
+      mupdf_rasters_insert(&mupdf_document->rasters, &key, generation, image, rowstride);
+    }
+  }
+  cairo_surface_mark_dirty_rectangle(surface, area.x0, area.y0, area.x1 - area.x0, area.y1 - area.y0);
+
+  /* the pages after the one on screen are prepared while the user reads it */
+  if (printing == false && error == ZATHURA_ERROR_OK) {
+    mupdf_prefetch_page_rendered(mupdf_document->prefetch, document, mupdf_page->index);
+  }
+
+  return error;
+}
+
+zathura_error_t mupdf_page_render_cairo_preview(zathura_page_t* page, mupdf_page_t* mupdf_page, cairo_t* cairo,
+                                                unsigned int reduction) {
+  if (page == NULL || mupdf_page == NULL || reduction == 0) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  cairo_surface_t* surface = cairo_get_target(cairo);
+  if (surface == NULL || cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ||
+      cairo_surface_get_type(surface) != CAIRO_SURFACE_TYPE_IMAGE) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  zathura_document_t* document = zathura_page_get_document(page);
+  if (document == NULL) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  unsigned int page_width  = cairo_image_surface_get_width(surface);
+  unsigned int page_height = cairo_image_surface_get_height(surface);
+  int preview_width        = MAX(1, (int)((page_width + reduction - 1) / reduction));
+  int preview_height       = MAX(1, (int)((page_height + reduction - 1) / reduction));
+
+  cairo_surface_t* preview = cairo_image_surface_create(CAIRO_FORMAT_RGB24, preview_width, preview_height);
+  if (cairo_surface_status(preview) != CAIRO_STATUS_SUCCESS) {
+    cairo_surface_destroy(preview);
+    return ZATHURA_ERROR_OUT_OF_MEMORY;
+  }
+
+  double scalex = ((double)preview_width) / zathura_page_get_width(page);
+  double scaley = ((double)preview_height) / zathura_page_get_height(page);
+
+  /* the preview is drawn without anti-aliasing, the bilinear upscale smooths its edges */
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  cairo_surface_flush(preview);
+  zathura_error_t error = mupdf_page_render_to_buffer(
+      mupdf_document, mupdf_page, page, cairo_image_surface_get_data(preview), cairo_image_surface_get_stride(preview),
+      fz_make_irect(0, 0, preview_width, preview_height), scalex, scaley, PREVIEW_AA_LEVEL);
+  cairo_surface_mark_dirty(preview);
+
+  if (error == ZATHURA_ERROR_OK) {
+    double device_scalex = 1;
+    double device_scaley = 1;
+    cairo_surface_get_device_scale(surface, &device_scalex, &device_scaley);
+
+    cairo_save(cairo);
+    cairo_identity_matrix(cairo);
+    cairo_scale(cairo, (double)page_width / preview_width / device_scalex,
+                (double)page_height / preview_height / device_scaley);
+    cairo_set_source_surface(cairo, preview, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(cairo), CAIRO_FILTER_BILINEAR);
+    cairo_paint(cairo);
+    cairo_restore(cairo);
+  }
+
+  cairo_surface_destroy(preview);
+
+  return error;
 }
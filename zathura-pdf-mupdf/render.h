@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: Zlib */
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "plugin.h"
+
+/**
+ * Renders an area of a page into a buffer in cairo's CAIRO_FORMAT_RGB24
+ * layout. The page's display list is built on first use, large areas are
+ * drawn in bands on the render pool.
+ *
+ * @param mupdf_document Mupdf document
+ * @param mupdf_page Mupdf page
+ * @param watched Page whose render is aborted once it is no longer visible or
+ *   NULL
+ * @param image The buffer, its origin is the origin of the scaled page
+ * @param rowstride Bytes per row of the buffer
+ * @param area Area of the scaled page that is rendered
+ * @param scalex Horizontal scale
+ * @param scaley Vertical scale
+ * @param aa_level Anti-aliasing bits or -1 for the context's level
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t mupdf_page_render_to_buffer(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+                                            zathura_page_t* watched, unsigned char* image, int rowstride,
+                                            fz_irect area, double scalex, double scaley, int aa_level);
+
+/**
+ * Renders a quick preview of a page onto a cairo object. The page is drawn at
+ * a reduced resolution without anti-aliasing and scaled up by cairo. The
+ * display list is shared with pdf_page_render_cairo, so a full render that
+ * follows only has to rasterize. Zathura has no hook for a second render
+ * pass, so this is only used by the benchmark harness.
+ *
+ * @param page Page
+ * @param mupdf_page Mupdf page
+ * @param cairo Cairo object
+ * @param reduction Factor the resolution is divided by
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t mupdf_page_render_cairo_preview(zathura_page_t* page, mupdf_page_t* mupdf_page, cairo_t* cairo,
+                                                unsigned int reduction);
+
+#endif // RENDER_H
@@ -1,12 +1,39 @@
 /* SPDX-License-Identifier: Zlib */
 
-#define N_SEARCH_RESULTS 512
-
 #include <glib.h>
 
 #include "plugin.h"
 #include "utils.h"
 
+static int pdf_page_search_hit(fz_context* GIRARA_UNUSED(ctx), void* opaque, int num_quads, fz_quad* hit_bbox) {
+  girara_list_t* list            = opaque;
+  zathura_rectangle_t* rectangle = NULL;
+
+  for (int i = 0; i < num_quads; i++) {
+    fz_rect r = fz_rect_from_quad(hit_bbox[i]);
+
+    /* the quads of a hit that share a line are merged into one rectangle */
+    if (rectangle != NULL && r.y0 < rectangle->y2 && r.y1 > rectangle->y1) {
+      rectangle->x1 = MIN(rectangle->x1, r.x0);
+      rectangle->x2 = MAX(rectangle->x2, r.x1);
+      rectangle->y1 = MIN(rectangle->y1, r.y0);
+      rectangle->y2 = MAX(rectangle->y2, r.y1);
+      continue;
+    }
+
+    rectangle     = g_malloc0(sizeof(zathura_rectangle_t));
+    rectangle->x1 = r.x0;
+    rectangle->x2 = r.x1;
+    rectangle->y1 = r.y0;
+    rectangle->y2 = r.y1;
+
+    girara_list_append(list, rectangle);
+  }
+
+  /* continue with the next hit */
+  return 0;
+}
+
 girara_list_t* pdf_page_search_text(zathura_page_t* page, void* data, const char* text, zathura_error_t* error) {
   if (page == NULL || text == NULL) {
     if (error != NULL) {
@@ -17,11 +44,15 @@ girara_list_t* pdf_page_search_text(zathura_page_t* page, void* data, const char
 
   mupdf_page_t* mupdf_page     = data;
   zathura_document_t* document = zathura_page_get_document(page);
-  if (document == NULL || mupdf_page == NULL || mupdf_page->text == NULL) {
+  if (document == NULL || mupdf_page == NULL) {
     goto error_ret;
   }
 
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    goto error_ret;
+  }
 
   girara_list_t* list = girara_list_new_with_free(g_free);
   if (list == NULL) {
@@ -31,31 +62,29 @@ girara_list_t* pdf_page_search_text(zathura_page_t* page, void* data, const char
     goto error_free;
   }
 
-  g_mutex_lock(&mupdf_document->mutex);
-
-  /* extract text */
-  if (mupdf_page->extracted_text == false) {
-    mupdf_page_extract_text(mupdf_document, mupdf_page);
+  /* pages whose text index rules out a match are skipped without extracting their text */
+  if (mupdf_text_index_may_contain(mupdf_document->text_index, mupdf_page->index, text) == false) {
+    return list;
   }
 
-  fz_quad* hit_bbox = fz_malloc_array(mupdf_page->ctx, N_SEARCH_RESULTS, fz_quad);
-  int num_results   = fz_search_stext_page(mupdf_page->ctx, mupdf_page->text, text, NULL, hit_bbox, N_SEARCH_RESULTS);
-
-  fz_rect r;
-  for (int i = 0; i < num_results; i++) {
-    zathura_rectangle_t* rectangle = g_malloc0(sizeof(zathura_rectangle_t));
+  g_mutex_lock(&mupdf_page->mutex);
 
-    r             = fz_rect_from_quad(hit_bbox[i]);
-    rectangle->x1 = r.x0;
-    rectangle->x2 = r.x1;
-    rectangle->y1 = r.y0;
-    rectangle->y2 = r.y1;
-
-    girara_list_append(list, rectangle);
+  /* extract text */
+  fz_stext_page* stext = mupdf_page_get_text(mupdf_document, mupdf_page);
+  if (stext == NULL) {
+    g_mutex_unlock(&mupdf_page->mutex);
+    goto error_free;
   }
 
-  fz_free(mupdf_page->ctx, hit_bbox);
-  g_mutex_unlock(&mupdf_document->mutex);
+  /* hits are collected as they are found, so there is no upper bound on their number */
+  fz_try(ctx) {
+    fz_search_stext_page_cb(ctx, stext, text, pdf_page_search_hit, list);
+  }
+  fz_catch(ctx) {
+    g_mutex_unlock(&mupdf_page->mutex);
+    goto error_free;
+  }
+  g_mutex_unlock(&mupdf_page->mutex);
 
   return list;
 
@@ -8,7 +8,7 @@
 char* pdf_page_get_text(zathura_page_t* page, void* data, zathura_rectangle_t rectangle, zathura_error_t* error) {
   mupdf_page_t* mupdf_page = data;
 
-  if (page == NULL || mupdf_page == NULL || mupdf_page->text == NULL) {
+  if (page == NULL || mupdf_page == NULL) {
     if (error != NULL) {
       *error = ZATHURA_ERROR_INVALID_ARGUMENTS;
     }
@@ -17,10 +17,17 @@ char* pdf_page_get_text(zathura_page_t* page, void* data, zathura_rectangle_t re
 
   zathura_document_t* document     = zathura_page_get_document(page);
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
-  g_mutex_lock(&mupdf_document->mutex);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    goto error_ret;
+  }
 
-  if (mupdf_page->extracted_text == false) {
-    mupdf_page_extract_text(mupdf_document, mupdf_page);
+  g_mutex_lock(&mupdf_page->mutex);
+
+  fz_stext_page* text = mupdf_page_get_text(mupdf_document, mupdf_page);
+  if (text == NULL) {
+    g_mutex_unlock(&mupdf_page->mutex);
+    goto error_ret;
   }
 
   fz_point a = {rectangle.x1, rectangle.y1};
@@ -28,11 +35,11 @@ char* pdf_page_get_text(zathura_page_t* page, void* data, zathura_rectangle_t re
 
   char* ret = NULL;
 #ifdef _WIN32
-  ret = fz_copy_selection(mupdf_page->ctx, mupdf_page->text, a, b, 1);
+  ret = fz_copy_selection(ctx, text, a, b, 1);
 #else
-  ret = fz_copy_selection(mupdf_page->ctx, mupdf_page->text, a, b, 0);
+  ret = fz_copy_selection(ctx, text, a, b, 0);
 #endif
-  g_mutex_unlock(&mupdf_document->mutex);
+  g_mutex_unlock(&mupdf_page->mutex);
   return ret;
 
 error_ret:
@@ -49,7 +56,7 @@ girara_list_t* pdf_page_get_selection(zathura_page_t* page, void* data, zathura_
 
   mupdf_page_t* mupdf_page = data;
 
-  if (page == NULL || mupdf_page == NULL || mupdf_page->text == NULL) {
+  if (page == NULL || mupdf_page == NULL) {
     if (error != NULL) {
       *error = ZATHURA_ERROR_INVALID_ARGUMENTS;
     }
@@ -58,10 +65,17 @@ girara_list_t* pdf_page_get_selection(zathura_page_t* page, void* data, zathura_
 
   zathura_document_t* document     = zathura_page_get_document(page);
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
-  g_mutex_lock(&mupdf_document->mutex);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    goto error_ret;
+  }
 
-  if (mupdf_page->extracted_text == false) {
-    mupdf_page_extract_text(mupdf_document, mupdf_page);
+  g_mutex_lock(&mupdf_page->mutex);
+
+  fz_stext_page* text = mupdf_page_get_text(mupdf_document, mupdf_page);
+  if (text == NULL) {
+    g_mutex_unlock(&mupdf_page->mutex);
+    goto error_ret;
   }
 
   fz_point a = {rectangle.x1, rectangle.y1};
@@ -75,8 +89,8 @@ girara_list_t* pdf_page_get_selection(zathura_page_t* page, void* data, zathura_
     goto error_free;
   }
 
-  fz_quad* hits   = fz_malloc_array(mupdf_page->ctx, MAX_QUADS, fz_quad);
-  int num_results = fz_highlight_selection(mupdf_page->ctx, mupdf_page->text, a, b, hits, MAX_QUADS);
+  fz_quad* hits   = fz_malloc_array(ctx, MAX_QUADS, fz_quad);
+  int num_results = fz_highlight_selection(ctx, text, a, b, hits, MAX_QUADS);
 
   fz_rect r;
   for (int i = 0; i < num_results; i++) {
@@ -91,13 +105,13 @@ girara_list_t* pdf_page_get_selection(zathura_page_t* page, void* data, zathura_
     girara_list_append(list, inner_rectangle);
   }
 
-  fz_free(mupdf_page->ctx, hits);
-  g_mutex_unlock(&mupdf_document->mutex);
+  fz_free(ctx, hits);
+  g_mutex_unlock(&mupdf_page->mutex);
 
   return list;
 
 error_free:
-  g_mutex_unlock(&mupdf_document->mutex);
+  g_mutex_unlock(&mupdf_page->mutex);
 
   if (list != NULL) {
     girara_list_free(list);
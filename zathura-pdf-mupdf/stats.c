@@ -0,0 +1,165 @@
+/* SPDX-License-Identifier: Zlib */
+
+#include <stdio.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
+
+#include "alloc.h"
+#include "plugin.h"
+#include "stats.h"
+
+#ifdef HAVE_SYS_SDT_H
+#define MUPDF_PROBE2(name, a, b) STAP_PROBE2(zathura_mupdf, name, a, b)
+#else
+#define MUPDF_PROBE2(name, a, b)
+#endif
+
+static const char* timer_names[MUPDF_STATS_TIMERS] = {
+    [MUPDF_STATS_INTERPRET] = "interpret",
+    [MUPDF_STATS_RASTER]    = "raster",
+    [MUPDF_STATS_TEXT]      = "text",
+    [MUPDF_STATS_LOCK_WAIT] = "lock_wait",
+    [MUPDF_STATS_LOCK_HOLD] = "lock_hold",
+};
+
+static const char* size_names[MUPDF_STATS_SIZES] = {
+    [MUPDF_STATS_DISPLAY_LIST_BYTES] = "display_list",
+    [MUPDF_STATS_TEXT_BYTES]         = "text",
+};
+
+void mupdf_stats_init(mupdf_stats_t* stats) {
+  const char* path = g_getenv("ZATHURA_MUPDF_STATS");
+
+  g_mutex_init(&stats->mutex);
+  stats->enabled = path != NULL && path[0] != '\0';
+  stats->path    = g_strdup(path);
+}
+
+void mupdf_stats_clear(mupdf_stats_t* stats) {
+  g_free(stats->path);
+  g_mutex_clear(&stats->mutex);
+}
+
+gint64 mupdf_stats_start(mupdf_stats_t* stats) {
+  return stats->enabled == true ? g_get_monotonic_time() : 0;
+}
+
+void mupdf_stats_stop(mupdf_stats_t* stats, mupdf_stats_timer_t timer, gint64 start) {
+  if (stats->enabled == false || start == 0) {
+    return;
+  }
+
+  gint64 duration = g_get_monotonic_time() - start;
+  MUPDF_PROBE2(timer, timer, duration);
+
+  g_mutex_lock(&stats->mutex);
+  stats->time[timer] += duration;
+  stats->count[timer]++;
+  g_mutex_unlock(&stats->mutex);
+}
+
+void mupdf_stats_add_bytes(mupdf_stats_t* stats, mupdf_stats_size_t size, size_t bytes) {
+  if (stats->enabled == false) {
+    return;
+  }
+
+  MUPDF_PROBE2(size, size, bytes);
+
+  g_mutex_lock(&stats->mutex);
+  stats->bytes[size] += bytes;
+  stats->max_bytes[size] = MAX(stats->max_bytes[size], bytes);
+  stats->n_bytes[size]++;
+  g_mutex_unlock(&stats->mutex);
+}
+
+static size_t mupdf_stats_cache_used(mupdf_cache_t* cache) {
+  g_mutex_lock(&cache->mutex);
+  const size_t used = cache->used;
+  g_mutex_unlock(&cache->mutex);
+
+  return used;
+}
+
+void mupdf_stats_sample_memory(mupdf_document_t* mupdf_document) {
+  mupdf_stats_t* stats = &mupdf_document->stats;
+  if (stats->enabled == false) {
+    return;
+  }
+
+  /* mupdf does not report the size of its store, everything allocated outside the caches is attributed to it */
+  const size_t in_use = mupdf_alloc_in_use();
+  const size_t cached =
+      mupdf_stats_cache_used(&mupdf_document->display_lists) + mupdf_stats_cache_used(&mupdf_document->texts);
+
+  g_mutex_lock(&stats->mutex);
+  stats->peak_in_use = MAX(stats->peak_in_use, in_use);
+  stats->peak_store  = MAX(stats->peak_store, in_use > cached ? in_use - cached : 0);
+  g_mutex_unlock(&stats->mutex);
+}
+
+static void mupdf_stats_dump_cache(FILE* file, const char* name, mupdf_cache_t* cache) {
+  g_mutex_lock(&cache->mutex);
+  fprintf(file,
+          ", \"%s_cache\": {\"hits\": %" G_GUINT64_FORMAT ", \"misses\": %" G_GUINT64_FORMAT
+          ", \"evictions\": %" G_GUINT64_FORMAT ", \"used\": %zu, \"peak\": %zu, \"budget\": %zu}",
+          name, cache->hits, cache->misses, cache->evictions, cache->used, cache->peak, cache->budget);
+  g_mutex_unlock(&cache->mutex);
+}
+
+void mupdf_stats_dump(mupdf_document_t* mupdf_document, const char* path) {
+  mupdf_stats_t* stats = &mupdf_document->stats;
+  if (stats->enabled == false) {
+    return;
+  }
+
+  FILE* file = fopen(stats->path, "a");
+  if (file == NULL) {
+    g_debug("failed to open statistics file %s", stats->path);
+    return;
+  }
+
+  /* the path is written as JSON string, escaping what needs to be escaped */
+  fprintf(file, "{\"pid\": %ld, \"document\": \"", (long)getpid());
+  for (const unsigned char* c = (const unsigned char*)(path != NULL ? path : ""); *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(file, "\\%c", *c);
+    } else if (*c < 0x20) {
+      fprintf(file, "\\u%04x", *c);
+    } else {
+      fputc(*c, file);
+    }
+  }
+  fputc('"', file);
+
+  g_mutex_lock(&stats->mutex);
+  for (unsigned int i = 0; i < MUPDF_STATS_TIMERS; i++) {
+    fprintf(file, ", \"%s\": {\"count\": %" G_GUINT64_FORMAT ", \"us\": %" G_GINT64_FORMAT "}", timer_names[i],
+            stats->count[i], stats->time[i]);
+  }
+  for (unsigned int i = 0; i < MUPDF_STATS_SIZES; i++) {
+    fprintf(file,
+            ", \"%s_bytes\": {\"count\": %" G_GUINT64_FORMAT ", \"total\": %" G_GUINT64_FORMAT
+            ", \"max\": %" G_GUINT64_FORMAT "}",
+            size_names[i], stats->n_bytes[i], stats->bytes[i], stats->max_bytes[i]);
+  }
+  const size_t peak_in_use = stats->peak_in_use;
+  const size_t peak_store  = stats->peak_store;
+  g_mutex_unlock(&stats->mutex);
+
+  fprintf(file, ", \"memory\": {\"budget\": %zu, \"store_budget\": %zu, \"peak_in_use\": %zu, \"peak_store\": %zu}",
+          mupdf_document->memory_budget, mupdf_document->store_budget, peak_in_use, peak_store);
+
+  size_t pool_reserved = 0;
+  size_t pool_used     = 0;
+  mupdf_alloc_pool_stats(&pool_reserved, &pool_used);
+  fprintf(file, ", \"pool\": {\"reserved\": %zu, \"used\": %zu}", pool_reserved, pool_used);
+
+  mupdf_stats_dump_cache(file, "page", &mupdf_document->pages);
+  mupdf_stats_dump_cache(file, "display_list", &mupdf_document->display_lists);
+  mupdf_stats_dump_cache(file, "text", &mupdf_document->texts);
+
+  fprintf(file, "}\n");
+  fclose(file);
+}
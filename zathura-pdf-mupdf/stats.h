@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: Zlib */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <glib.h>
+
+typedef struct mupdf_document_s mupdf_document_t;
+
+typedef enum mupdf_stats_timer_e {
+  MUPDF_STATS_INTERPRET, /**< Running pages into display lists */
+  MUPDF_STATS_RASTER,    /**< Drawing display lists into the target buffer */
+  MUPDF_STATS_TEXT,      /**< Extracting page text */
+  MUPDF_STATS_LOCK_WAIT, /**< Waiting for the document mutex */
+  MUPDF_STATS_LOCK_HOLD, /**< Holding the document mutex */
+  MUPDF_STATS_TIMERS,
+} mupdf_stats_timer_t;
+
+typedef enum mupdf_stats_size_e {
+  MUPDF_STATS_DISPLAY_LIST_BYTES, /**< Size of built display lists */
+  MUPDF_STATS_TEXT_BYTES,         /**< Size of extracted page texts */
+  MUPDF_STATS_SIZES,
+} mupdf_stats_size_t;
+
+typedef struct mupdf_stats_s {
+  bool enabled;                         /**< If anything is measured, fixed at document open */
+  gchar* path;                          /**< File the statistics are appended to */
+  GMutex mutex;                         /**< Guards the counters */
+  gint64 time[MUPDF_STATS_TIMERS];      /**< Accumulated microseconds */
+  guint64 count[MUPDF_STATS_TIMERS];    /**< Number of measurements */
+  guint64 bytes[MUPDF_STATS_SIZES];     /**< Accumulated bytes */
+  guint64 max_bytes[MUPDF_STATS_SIZES]; /**< Largest single page */
+  guint64 n_bytes[MUPDF_STATS_SIZES];   /**< Number of pages */
+  size_t peak_in_use;                   /**< Most bytes allocated at a sample */
+  size_t peak_store;                    /**< Most bytes attributed to the store at a sample */
+  gint64 locked_at;                     /**< When the document mutex was taken, only used by its holder */
+} mupdf_stats_t;
+
+/**
+ * Initializes the statistics. They are enabled if ZATHURA_MUPDF_STATS names
+ * the file they are dumped to.
+ *
+ * @param stats The statistics
+ */
+void mupdf_stats_init(mupdf_stats_t* stats);
+
+/**
+ * Frees the resources of the statistics
+ *
+ * @param stats The statistics
+ */
+void mupdf_stats_clear(mupdf_stats_t* stats);
+
+/**
+ * Starts a measurement
+ *
+ * @param stats The statistics
+ * @return The current time or 0 if the statistics are disabled
+ */
+gint64 mupdf_stats_start(mupdf_stats_t* stats);
+
+/**
+ * Accounts the time since a measurement was started and fires the timer
+ * probe
+ *
+ * @param stats The statistics
+ * @param timer The timer
+ * @param start Value returned by mupdf_stats_start
+ */
+void mupdf_stats_stop(mupdf_stats_t* stats, mupdf_stats_timer_t timer, gint64 start);
+
+/**
+ * Accounts the size of the resource built for a page and fires the size probe
+ *
+ * @param stats The statistics
+ * @param size The kind of resource
+ * @param bytes The size in bytes
+ */
+void mupdf_stats_add_bytes(mupdf_stats_t* stats, mupdf_stats_size_t size, size_t bytes);
+
+/**
+ * Samples the allocated memory and the share of the store after a resource
+ * was cached. The pages are cleared before the document is freed, so the
+ * dump reports the peaks instead of the nearly empty final state.
+ *
+ * @param mupdf_document Mupdf document
+ */
+void mupdf_stats_sample_memory(mupdf_document_t* mupdf_document);
+
+/**
+ * Appends the statistics and the cache counters of a document as one line of
+ * JSON to the statistics file
+ *
+ * @param mupdf_document Mupdf document
+ * @param path Path of the document
+ */
+void mupdf_stats_dump(mupdf_document_t* mupdf_document, const char* path);
+
+#endif // STATS_H
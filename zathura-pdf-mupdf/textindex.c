@@ -0,0 +1,315 @@
+/* SPDX-License-Identifier: Zlib */
+
+#include "plugin.h"
+#include "textindex.h"
+#include "utils.h"
+
+#define TEXT_INDEX_FILTER_BITS (TEXT_INDEX_FILTER_SIZE * 8)
+
+#define TEXT_INDEX_MAGIC "ZMUPTIDX"
+#define TEXT_INDEX_VERSION 1
+
+/* layout of a persisted index: the header, one ready byte per page padded to 8 bytes and the filters */
+typedef struct text_index_header_s {
+  char magic[8];
+  guint32 version;
+  guint32 filter_size;
+  guint32 n_pages;
+  guint32 padding;
+} text_index_header_t;
+
+static size_t mupdf_text_index_filters_offset(int n_pages) {
+  return sizeof(text_index_header_t) + (((size_t)n_pages + 7) & ~(size_t)7);
+}
+
+/* mupdf's search matches these against any white space, a hyphen at the end of a line joins the lines */
+static bool mupdf_text_index_is_separator(int c) {
+  return c <= ' ' || c == '-' || c == 0xA0 || c == 0x2028 || c == 0x2029;
+}
+
+static unsigned int mupdf_text_index_hash(const int trigram[3]) {
+  guint32 hash = 2166136261u;
+  for (unsigned int i = 0; i < 3; i++) {
+    hash = (hash ^ (guint32)trigram[i]) * 16777619u;
+  }
+
+  return hash % TEXT_INDEX_FILTER_BITS;
+}
+
+static void mupdf_text_index_shift(int trigram[3], int c) {
+  trigram[0] = trigram[1];
+  trigram[1] = trigram[2];
+  trigram[2] = fz_tolower(c);
+}
+
+void mupdf_text_index_add_page(mupdf_text_index_t* text_index, int page, fz_stext_page* text) {
+  if (text_index == NULL || page < 0 || page >= text_index->n_pages || text == NULL) {
+    return;
+  }
+
+  guint8* filter = text_index->filters + (size_t)page * TEXT_INDEX_FILTER_SIZE;
+
+  for (fz_stext_block* block = text->first_block; block != NULL; block = block->next) {
+    if (block->type != FZ_STEXT_BLOCK_TEXT) {
+      continue;
+    }
+
+    int trigram[3] = {0};
+    unsigned int n = 0;
+    for (fz_stext_line* line = block->u.t.first_line; line != NULL; line = line->next) {
+      bool joined = false;
+      for (fz_stext_char* ch = line->first_char; ch != NULL; ch = ch->next) {
+        if (ch->c == '-' && ch->next == NULL) {
+          joined = true;
+        } else if (mupdf_text_index_is_separator(ch->c) == true) {
+          n = 0;
+        } else {
+          mupdf_text_index_shift(trigram, ch->c);
+          if (++n >= 3) {
+            unsigned int bit = mupdf_text_index_hash(trigram);
+            filter[bit / 8] |= 1 << (bit % 8);
+          }
+        }
+      }
+
+      if (joined == false) {
+        n = 0;
+      }
+    }
+  }
+
+  g_atomic_int_set(&text_index->ready[page], 1);
+}
+
+bool mupdf_text_index_may_contain(mupdf_text_index_t* text_index, int page, const char* needle) {
+  if (text_index == NULL || page < 0 || page >= text_index->n_pages || needle == NULL ||
+      g_atomic_int_get(&text_index->ready[page]) == 0) {
+    return true;
+  }
+
+  const guint8* filter = text_index->filters + (size_t)page * TEXT_INDEX_FILTER_SIZE;
+
+  int trigram[3] = {0};
+  unsigned int n = 0;
+  while (*needle != '\0') {
+    int c = 0;
+    needle += fz_chartorune(&c, needle);
+
+    if (mupdf_text_index_is_separator(c) == true) {
+      n = 0;
+      continue;
+    }
+
+    mupdf_text_index_shift(trigram, c);
+    if (++n >= 3) {
+      unsigned int bit = mupdf_text_index_hash(trigram);
+      if ((filter[bit / 8] & (1 << (bit % 8))) == 0) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static fz_stext_page* mupdf_text_index_extract(mupdf_document_t* mupdf_document, fz_context* ctx, int index) {
+  fz_page* volatile page          = NULL;
+  fz_stext_page* volatile text    = NULL;
+  fz_device* volatile text_device = NULL;
+
+  /* the same options as mupdf_page_get_text, so that both see the same characters */
+  mupdf_document_lock(mupdf_document);
+  fz_try(ctx) {
+    page = fz_load_page(ctx, mupdf_document->document, index);
+    text = fz_new_stext_page(ctx, fz_bound_page(ctx, page));
+
+    /* only the characters are indexed */
+    fz_stext_options stext_options = {0};
+    text_device                    = fz_new_stext_device(ctx, text, &stext_options);
+    fz_run_page(ctx, page, text_device, fz_identity, NULL);
+    fz_close_device(ctx, text_device);
+  }
+  fz_always(ctx) {
+    fz_drop_device(ctx, text_device);
+    fz_drop_page(ctx, page);
+  }
+  fz_catch(ctx) {
+    /* pages that fail are never marked as indexed and thus always searched */
+    fz_drop_stext_page(ctx, text);
+    text = NULL;
+  }
+  mupdf_document_unlock(mupdf_document);
+
+  return text;
+}
+
+static gpointer mupdf_text_index_run(gpointer data) {
+  mupdf_text_index_t* text_index = data;
+
+  fz_context* ctx = mupdf_document_get_context(text_index->mupdf_document);
+  if (ctx == NULL) {
+    return NULL;
+  }
+
+  for (int i = 0; i < text_index->n_pages; i++) {
+    if (g_atomic_int_get(&text_index->cancel) != 0) {
+      return NULL;
+    }
+
+    /* the document mutex is released between pages so that rendering is not held up */
+    fz_stext_page* text = mupdf_text_index_extract(text_index->mupdf_document, ctx, i);
+    if (text != NULL) {
+      mupdf_text_index_add_page(text_index, i, text);
+      fz_drop_stext_page(ctx, text);
+    }
+
+    /* the thread keeps its normal priority, a lower one would hold up renders waiting for the mutex it holds */
+    g_thread_yield();
+  }
+
+  g_atomic_int_set(&text_index->complete, 1);
+
+  return NULL;
+}
+
+static bool mupdf_text_index_load(mupdf_text_index_t* text_index) {
+  GMappedFile* mapped = g_mapped_file_new(text_index->cache_path, FALSE, NULL);
+  if (mapped == NULL) {
+    return false;
+  }
+
+  const char* contents = g_mapped_file_get_contents(mapped);
+  gsize length         = g_mapped_file_get_length(mapped);
+  size_t offset        = mupdf_text_index_filters_offset(text_index->n_pages);
+
+  text_index_header_t header;
+  if (contents == NULL || length != offset + (size_t)text_index->n_pages * TEXT_INDEX_FILTER_SIZE) {
+    goto error_free;
+  }
+
+  memcpy(&header, contents, sizeof(header));
+  if (memcmp(header.magic, TEXT_INDEX_MAGIC, sizeof(header.magic)) != 0 || header.version != TEXT_INDEX_VERSION ||
+      header.filter_size != TEXT_INDEX_FILTER_SIZE || header.n_pages != (guint32)text_index->n_pages) {
+    goto error_free;
+  }
+
+  /* the filters are used in place, the indexer never runs on a loaded index */
+  const guint8* ready = (const guint8*)contents + sizeof(header);
+  for (int i = 0; i < text_index->n_pages; i++) {
+    text_index->ready[i] = ready[i] != 0;
+  }
+  text_index->filters = (guint8*)contents + offset;
+  text_index->mapped  = mapped;
+
+  return true;
+
+error_free:
+
+  g_mapped_file_unref(mapped);
+
+  return false;
+}
+
+static void mupdf_text_index_save(mupdf_text_index_t* text_index) {
+  size_t offset = mupdf_text_index_filters_offset(text_index->n_pages);
+  size_t length = offset + (size_t)text_index->n_pages * TEXT_INDEX_FILTER_SIZE;
+  guint8* data  = g_try_malloc0(length);
+  if (data == NULL) {
+    return;
+  }
+
+  text_index_header_t header = {
+      .version     = TEXT_INDEX_VERSION,
+      .filter_size = TEXT_INDEX_FILTER_SIZE,
+      .n_pages     = text_index->n_pages,
+  };
+  memcpy(header.magic, TEXT_INDEX_MAGIC, sizeof(header.magic));
+  memcpy(data, &header, sizeof(header));
+
+  for (int i = 0; i < text_index->n_pages; i++) {
+    data[sizeof(header) + i] = text_index->ready[i] != 0;
+  }
+  memcpy(data + offset, text_index->filters, (size_t)text_index->n_pages * TEXT_INDEX_FILTER_SIZE);
+
+  /* g_file_set_contents replaces the file atomically, readers never see a partial index */
+  gchar* directory = g_path_get_dirname(text_index->cache_path);
+  if (g_mkdir_with_parents(directory, 0700) == 0 &&
+      g_file_set_contents(text_index->cache_path, (const gchar*)data, length, NULL) == FALSE) {
+    g_debug("failed to write text index %s", text_index->cache_path);
+  }
+  g_free(directory);
+  g_free(data);
+}
+
+mupdf_text_index_t* mupdf_text_index_new(mupdf_document_t* mupdf_document, const char* path) {
+  if (mupdf_document == NULL || mupdf_document->document == NULL) {
+    return NULL;
+  }
+
+  mupdf_text_index_t* text_index = g_try_malloc0(sizeof(mupdf_text_index_t));
+  if (text_index == NULL) {
+    return NULL;
+  }
+
+  /* the layout of the filters is part of the key */
+  gchar variant[32];
+  g_snprintf(variant, sizeof(variant), ":%d:%d", TEXT_INDEX_VERSION, TEXT_INDEX_FILTER_SIZE);
+
+  text_index->mupdf_document = mupdf_document;
+  text_index->n_pages        = fz_count_pages(mupdf_document->ctx, mupdf_document->document);
+  text_index->ready          = g_try_malloc0_n(text_index->n_pages, sizeof(gint));
+  text_index->cache_path =
+      mupdf_document_get_cache_path(mupdf_document, mupdf_document->ctx, path, variant, ".index");
+  if (text_index->n_pages <= 0 || text_index->ready == NULL) {
+    goto error_free;
+  }
+
+  if (text_index->cache_path != NULL && mupdf_text_index_load(text_index) == true) {
+    return text_index;
+  }
+
+  text_index->filters = g_try_malloc0_n(text_index->n_pages, TEXT_INDEX_FILTER_SIZE);
+  if (text_index->filters == NULL) {
+    goto error_free;
+  }
+
+  text_index->thread = g_thread_try_new("mupdf-text-index", mupdf_text_index_run, text_index, NULL);
+  if (text_index->thread == NULL) {
+    goto error_free;
+  }
+
+  return text_index;
+
+error_free:
+
+  g_free(text_index->cache_path);
+  g_free(text_index->ready);
+  g_free(text_index->filters);
+  g_free(text_index);
+
+  return NULL;
+}
+
+void mupdf_text_index_free(mupdf_text_index_t* text_index) {
+  if (text_index == NULL) {
+    return;
+  }
+
+  if (text_index->thread != NULL) {
+    g_atomic_int_set(&text_index->cancel, 1);
+    g_thread_join(text_index->thread);
+  }
+
+  if (text_index->mapped != NULL) {
+    g_mapped_file_unref(text_index->mapped);
+  } else {
+    if (text_index->cache_path != NULL && g_atomic_int_get(&text_index->complete) != 0) {
+      mupdf_text_index_save(text_index);
+    }
+    g_free(text_index->filters);
+  }
+
+  g_free(text_index->cache_path);
+  g_free(text_index->ready);
+  g_free(text_index);
+}
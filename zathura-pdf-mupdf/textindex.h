@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: Zlib */
+
+#ifndef TEXTINDEX_H
+#define TEXTINDEX_H
+
+#include <stdbool.h>
+#include <glib.h>
+#include <mupdf/fitz.h>
+
+/* bytes of the trigram filter of every page */
+#define TEXT_INDEX_FILTER_SIZE 1024
+
+typedef struct mupdf_document_s mupdf_document_t;
+
+typedef struct mupdf_text_index_s {
+  mupdf_document_t* mupdf_document; /**< Indexed document */
+  GThread* thread;                  /**< Background indexer */
+  gint cancel;                      /**< Set to stop the indexer */
+  gint complete;                    /**< Set once the indexer visited every page */
+  int n_pages;                      /**< Number of indexed pages */
+  guint8* filters;                  /**< n_pages filters of TEXT_INDEX_FILTER_SIZE bytes */
+  gint* ready;                      /**< If the filter of a page is complete, accessed atomically */
+  gchar* cache_path;                /**< File the index is persisted in, NULL if the document has no key */
+  GMappedFile* mapped;              /**< Mapping of cache_path that filters points into, if loaded from disk */
+} mupdf_text_index_t;
+
+/**
+ * Maps the index persisted for the document from the cache directory or, if
+ * there is none, starts indexing the text of all pages on a background thread.
+ * The persisted index is keyed by the document's ID, size and modification
+ * time.
+ *
+ * @param mupdf_document Mupdf document
+ * @param path Path of the document file
+ * @return The index or NULL if an error occurred
+ */
+mupdf_text_index_t* mupdf_text_index_new(mupdf_document_t* mupdf_document, const char* path);
+
+/**
+ * Stops the indexer, persists the index if every page was visited and frees
+ * the index
+ *
+ * @param text_index The index
+ */
+void mupdf_text_index_free(mupdf_text_index_t* text_index);
+
+/**
+ * Adds the trigrams of the text of a page to its filter and marks the page as
+ * indexed
+ *
+ * @param text_index The index
+ * @param page Page number
+ * @param text Text of the page
+ */
+void mupdf_text_index_add_page(mupdf_text_index_t* text_index, int page, fz_stext_page* text);
+
+/**
+ * Checks if a search could match on a page. Pages that are not indexed yet
+ * may always match.
+ *
+ * @param text_index The index or NULL
+ * @param page Page number
+ * @param needle The searched text
+ * @return false if the page certainly does not contain needle
+ */
+bool mupdf_text_index_may_contain(mupdf_text_index_t* text_index, int page, const char* needle);
+
+#endif // TEXTINDEX_H
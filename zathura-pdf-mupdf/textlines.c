@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: Zlib */
+
+#include <stdbool.h>
+
+#include "textlines.h"
+
+/* a line overlapping one of the areas that are copied */
+typedef struct mupdf_text_hit_s {
+  const mupdf_text_line_t* line;
+  unsigned int area;
+} mupdf_text_hit_t;
+
+static gint mupdf_text_line_compare_top(gconstpointer a, gconstpointer b) {
+  const mupdf_text_line_t* line_a = a;
+  const mupdf_text_line_t* line_b = b;
+
+  return (line_a->bbox.y0 > line_b->bbox.y0) - (line_a->bbox.y0 < line_b->bbox.y0);
+}
+
+static gint mupdf_text_hit_compare(gconstpointer a, gconstpointer b) {
+  const mupdf_text_hit_t* hit_a = a;
+  const mupdf_text_hit_t* hit_b = b;
+
+  if (hit_a->line->order != hit_b->line->order) {
+    return hit_a->line->order < hit_b->line->order ? -1 : 1;
+  }
+
+  return (hit_a->area > hit_b->area) - (hit_a->area < hit_b->area);
+}
+
+mupdf_text_lines_t* mupdf_text_lines_new(fz_stext_page* text) {
+  mupdf_text_lines_t* lines = g_malloc0(sizeof(mupdf_text_lines_t));
+  lines->lines              = g_array_new(FALSE, FALSE, sizeof(mupdf_text_line_t));
+
+  unsigned int order = 0;
+  for (fz_stext_block* block = text->first_block; block != NULL; block = block->next) {
+    if (block->type != FZ_STEXT_BLOCK_TEXT) {
+      continue;
+    }
+
+    for (fz_stext_line* line = block->u.t.first_line; line != NULL; line = line->next) {
+      mupdf_text_line_t entry = {.line = line, .bbox = line->bbox, .order = order++};
+      if (fz_is_empty_rect(entry.bbox) != 0) {
+        continue;
+      }
+
+      lines->max_height = MAX(lines->max_height, entry.bbox.y1 - entry.bbox.y0);
+      g_array_append_val(lines->lines, entry);
+    }
+  }
+
+  g_array_sort(lines->lines, mupdf_text_line_compare_top);
+
+  return lines;
+}
+
+void mupdf_text_lines_free(mupdf_text_lines_t* lines) {
+  if (lines == NULL) {
+    return;
+  }
+
+  g_array_free(lines->lines, TRUE);
+  g_free(lines);
+}
+
+/* index of the first line whose top edge lies below y */
+static guint mupdf_text_lines_bound(mupdf_text_lines_t* lines, float y) {
+  guint low  = 0;
+  guint high = lines->lines->len;
+  while (low < high) {
+    guint middle = low + (high - low) / 2;
+    if (g_array_index(lines->lines, mupdf_text_line_t, middle).bbox.y0 <= y) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return low;
+}
+
+void mupdf_text_lines_find(mupdf_text_lines_t* lines, fz_rect area, GPtrArray* found) {
+  /* a line that starts more than the tallest line's height above the area ends above it */
+  const guint begin = mupdf_text_lines_bound(lines, area.y0 - lines->max_height);
+  const guint end   = mupdf_text_lines_bound(lines, area.y1);
+
+  for (guint i = begin; i < end; i++) {
+    mupdf_text_line_t* line = &g_array_index(lines->lines, mupdf_text_line_t, i);
+    if (line->bbox.y1 > area.y0 && line->bbox.x0 < area.x1 && line->bbox.x1 > area.x0) {
+      g_ptr_array_add(found, line);
+    }
+  }
+}
+
+gchar* mupdf_text_lines_copy(mupdf_text_lines_t* lines, const fz_rect* areas, unsigned int n_areas) {
+  GArray* hits     = g_array_new(FALSE, FALSE, sizeof(mupdf_text_hit_t));
+  GPtrArray* found = g_ptr_array_new();
+  for (unsigned int i = 0; i < n_areas; i++) {
+    g_ptr_array_set_size(found, 0);
+    mupdf_text_lines_find(lines, areas[i], found);
+    for (guint j = 0; j < found->len; j++) {
+      mupdf_text_hit_t hit = {.line = g_ptr_array_index(found, j), .area = i};
+      g_array_append_val(hits, hit);
+    }
+  }
+  g_ptr_array_free(found, TRUE);
+
+  /* the hits of a line are adjacent, so that its characters are only compared with the areas it overlaps */
+  g_array_sort(hits, mupdf_text_hit_compare);
+
+  GString* string = g_string_new(NULL);
+  for (guint i = 0; i < hits->len;) {
+    const mupdf_text_line_t* line = g_array_index(hits, mupdf_text_hit_t, i).line;
+    guint end                     = i;
+    while (end < hits->len && g_array_index(hits, mupdf_text_hit_t, end).line == line) {
+      end++;
+    }
+
+    bool copied = false;
+    for (fz_stext_char* ch = line->line->first_char; ch != NULL; ch = ch->next) {
+      fz_rect box        = fz_rect_from_quad(ch->quad);
+      const fz_point mid = fz_make_point((box.x0 + box.x1) / 2, (box.y0 + box.y1) / 2);
+
+      for (guint j = i; j < end; j++) {
+        if (fz_is_point_inside_rect(mid, areas[g_array_index(hits, mupdf_text_hit_t, j).area]) != 0) {
+          if (copied == false && string->len > 0) {
+            g_string_append_c(string, '\n');
+          }
+          copied = true;
+          g_string_append_unichar(string, ch->c);
+          break;
+        }
+      }
+    }
+
+    i = end;
+  }
+  g_array_free(hits, TRUE);
+
+  return g_string_free(string, FALSE);
+}
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: Zlib */
+
+#ifndef TEXTLINES_H
+#define TEXTLINES_H
+
+#include <glib.h>
+#include <mupdf/fitz.h>
+
+typedef struct mupdf_text_line_s {
+  fz_stext_line* line; /**< The line, owned by the text page */
+  fz_rect bbox;        /**< Bbox of the line */
+  unsigned int order;  /**< Position of the line in reading order */
+} mupdf_text_line_t;
+
+typedef struct mupdf_text_lines_s {
+  GArray* lines;    /**< Lines as mupdf_text_line_t sorted by their top edge */
+  float max_height; /**< Height of the tallest line, bounds how far above an area overlapping lines start */
+} mupdf_text_lines_t;
+
+/**
+ * Indexes the lines of a text page by their position
+ *
+ * @param text The text page, has to outlive the index
+ * @return The index
+ */
+mupdf_text_lines_t* mupdf_text_lines_new(fz_stext_page* text);
+
+/**
+ * Frees the index
+ *
+ * @param lines The index
+ */
+void mupdf_text_lines_free(mupdf_text_lines_t* lines);
+
+/**
+ * Collects the lines overlapping an area
+ *
+ * @param lines The index
+ * @param area The area
+ * @param found Receives pointers to the mupdf_text_line_t of the lines
+ */
+void mupdf_text_lines_find(mupdf_text_lines_t* lines, fz_rect area, GPtrArray* found);
+
+/**
+ * Copies the characters whose centre lies in one of several areas. Every line
+ * is visited once, in reading order, and lines are separated by newlines.
+ *
+ * @param lines The index
+ * @param areas The areas
+ * @param n_areas Number of areas
+ * @return The text, free with g_free
+ */
+gchar* mupdf_text_lines_copy(mupdf_text_lines_t* lines, const fz_rect* areas, unsigned int n_areas);
+
+#endif // TEXTLINES_H
@@ -0,0 +1,268 @@
+/* SPDX-License-Identifier: Zlib */
+
+#include <glib.h>
+#include <mupdf/pdf.h>
+
+#include "plugin.h"
+#include "render.h"
+#include "thumbnail.h"
+#include "utils.h"
+
+/* part of the key of the cached thumbnails, bumped whenever their rendering changes */
+#define THUMBNAIL_VERSION 1
+
+typedef struct thumbnail_batch_s {
+  mupdf_document_t* mupdf_document;
+  gchar* cache_directory; /**< Directory of the cached thumbnails, NULL if they are not cached */
+  unsigned int size;      /**< Edge length of the box the thumbnails fit into */
+  GMutex mutex;
+  GCond cond;
+  unsigned int pending; /**< Thumbnails not yet rendered */
+} thumbnail_batch_t;
+
+typedef struct thumbnail_task_s {
+  thumbnail_batch_t* batch;
+  zathura_page_t* page;
+  cairo_surface_t** thumbnail;
+} thumbnail_task_t;
+
+static cairo_status_t pdf_thumbnail_write(void* closure, const unsigned char* data, unsigned int length) {
+  g_byte_array_append(closure, data, length);
+  return CAIRO_STATUS_SUCCESS;
+}
+
+static gchar* pdf_thumbnail_cache_path(thumbnail_batch_t* batch, mupdf_page_t* mupdf_page) {
+  gchar filename[64];
+  g_snprintf(filename, sizeof(filename), "%d-%u.png", mupdf_page->index, batch->size);
+
+  return g_build_filename(batch->cache_directory, filename, NULL);
+}
+
+static cairo_surface_t* pdf_thumbnail_load(thumbnail_batch_t* batch, mupdf_page_t* mupdf_page, int width,
+                                           int height) {
+  gchar* path              = pdf_thumbnail_cache_path(batch, mupdf_page);
+  cairo_surface_t* surface = cairo_image_surface_create_from_png(path);
+  g_free(path);
+
+  /* a file of another size belongs to a different page size and is rendered again */
+  if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ||
+      cairo_image_surface_get_format(surface) != CAIRO_FORMAT_RGB24 ||
+      cairo_image_surface_get_width(surface) != width || cairo_image_surface_get_height(surface) != height) {
+    cairo_surface_destroy(surface);
+    return NULL;
+  }
+
+  return surface;
+}
+
+static void pdf_thumbnail_save(thumbnail_batch_t* batch, mupdf_page_t* mupdf_page, cairo_surface_t* surface) {
+  GByteArray* png = g_byte_array_new();
+  if (cairo_surface_write_to_png_stream(surface, pdf_thumbnail_write, png) == CAIRO_STATUS_SUCCESS) {
+    /* g_file_set_contents replaces the file atomically, readers never see a partial thumbnail */
+    gchar* path = pdf_thumbnail_cache_path(batch, mupdf_page);
+    if (g_file_set_contents(path, (const gchar*)png->data, png->len, NULL) == FALSE) {
+      g_debug("failed to write thumbnail %s", path);
+    }
+    g_free(path);
+  }
+  g_byte_array_free(png, TRUE);
+}
+
+/* decodes the page's /Thumb image if it covers the thumbnail */
+static cairo_surface_t* pdf_thumbnail_get_embedded(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+                                                   fz_context* ctx, int width, int height) {
+  fz_image* volatile image = NULL;
+
+  /* the page object is enough, the page itself is only loaded if the thumbnail has to be rendered */
+  mupdf_document_lock(mupdf_document);
+  pdf_document* pdf_document = pdf_specifics(ctx, mupdf_document->document);
+  if (pdf_document != NULL) {
+    fz_try(ctx) {
+      pdf_obj* page_obj = pdf_lookup_page_obj(ctx, pdf_document, mupdf_page->index);
+      pdf_obj* thumb    = pdf_dict_get(ctx, page_obj, PDF_NAME(Thumb));
+      if (pdf_is_stream(ctx, thumb) != 0) {
+        image = pdf_load_image(ctx, pdf_document, thumb);
+      }
+    }
+    fz_catch(ctx) {
+      image = NULL;
+    }
+  }
+  mupdf_document_unlock(mupdf_document);
+
+  if (image == NULL) {
+    return NULL;
+  }
+
+  /* embedded thumbnails are rarely larger than 106 pixels, smaller ones would have to be enlarged */
+  cairo_surface_t* surface = NULL;
+  if (image->w >= width && image->h >= height) {
+    surface = mupdf_image_get_cairo(ctx, image, width, height);
+  }
+  fz_drop_image(ctx, image);
+
+  return surface;
+}
+
+static cairo_surface_t* pdf_thumbnail_render(thumbnail_batch_t* batch, zathura_page_t* page) {
+  mupdf_document_t* mupdf_document = batch->mupdf_document;
+  mupdf_page_t* mupdf_page         = zathura_page_get_data(page);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (mupdf_page == NULL || ctx == NULL) {
+    return NULL;
+  }
+
+  const double page_width  = zathura_page_get_width(page);
+  const double page_height = zathura_page_get_height(page);
+  if (page_width <= 0 || page_height <= 0) {
+    return NULL;
+  }
+
+  const double scale = batch->size / MAX(page_width, page_height);
+  const int width    = MAX(1, (int)(page_width * scale + 0.5));
+  const int height   = MAX(1, (int)(page_height * scale + 0.5));
+
+  cairo_surface_t* surface = NULL;
+  if (batch->cache_directory != NULL) {
+    surface = pdf_thumbnail_load(batch, mupdf_page, width, height);
+    if (surface != NULL) {
+      return surface;
+    }
+  }
+
+  surface = pdf_thumbnail_get_embedded(mupdf_document, mupdf_page, ctx, width, height);
+  if (surface == NULL) {
+    surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+      cairo_surface_destroy(surface);
+      return NULL;
+    }
+
+    /* images are decoded at the size they are drawn at, so large scans are subsampled while decoding */
+    cairo_surface_flush(surface);
+    zathura_error_t error =
+        mupdf_page_render_to_buffer(mupdf_document, mupdf_page, NULL, cairo_image_surface_get_data(surface),
+                                    cairo_image_surface_get_stride(surface), fz_make_irect(0, 0, width, height),
+                                    (double)width / page_width, (double)height / page_height, -1);
+    cairo_surface_mark_dirty(surface);
+    if (error != ZATHURA_ERROR_OK) {
+      cairo_surface_destroy(surface);
+      return NULL;
+    }
+  }
+
+  if (batch->cache_directory != NULL) {
+    pdf_thumbnail_save(batch, mupdf_page, surface);
+  }
+
+  return surface;
+}
+
+static void pdf_thumbnail_worker(gpointer data, gpointer GIRARA_UNUSED(user_data)) {
+  thumbnail_task_t* task   = data;
+  thumbnail_batch_t* batch = task->batch;
+
+  *task->thumbnail = pdf_thumbnail_render(batch, task->page);
+
+  g_mutex_lock(&batch->mutex);
+  batch->pending--;
+  g_cond_signal(&batch->cond);
+  g_mutex_unlock(&batch->mutex);
+}
+
+static GThreadPool* pdf_thumbnail_get_pool(mupdf_document_t* mupdf_document) {
+  g_mutex_lock(&mupdf_document->contexts_mutex);
+  if (mupdf_document->thumbnail_pool == NULL) {
+    /* the threads are exclusive, so that their contexts live as long as the pool */
+    const unsigned int threads     = CLAMP(g_get_num_processors(), 1, RENDER_BANDS_MAX);
+    mupdf_document->thumbnail_pool = g_thread_pool_new(pdf_thumbnail_worker, NULL, threads, TRUE, NULL);
+  }
+  GThreadPool* pool = mupdf_document->thumbnail_pool;
+  g_mutex_unlock(&mupdf_document->contexts_mutex);
+
+  return pool;
+}
+
+/* the directory of the cached thumbnails, NULL if they cannot be cached */
+static gchar* pdf_thumbnail_cache_directory(mupdf_document_t* mupdf_document, const char* path) {
+  if (mupdf_document->thumbnail_cache == false) {
+    return NULL;
+  }
+
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    return NULL;
+  }
+
+  gchar variant[32];
+  g_snprintf(variant, sizeof(variant), ":thumbnails:%d", THUMBNAIL_VERSION);
+
+  /* thumbnails of unsaved changes would outlive the changes */
+  gchar* directory = NULL;
+  mupdf_document_lock(mupdf_document);
+  pdf_document* pdf_document = pdf_specifics(ctx, mupdf_document->document);
+  if (pdf_document == NULL || pdf_has_unsaved_changes(ctx, pdf_document) == 0) {
+    directory = mupdf_document_get_cache_path(mupdf_document, ctx, path, variant, ".thumbnails");
+  }
+  mupdf_document_unlock(mupdf_document);
+
+  if (directory != NULL && g_mkdir_with_parents(directory, 0700) != 0) {
+    g_free(directory);
+    return NULL;
+  }
+
+  return directory;
+}
+
+zathura_error_t mupdf_document_render_thumbnails(zathura_document_t* document, mupdf_document_t* mupdf_document,
+                                                zathura_page_t** pages, unsigned int n_pages, unsigned int size,
+                                                cairo_surface_t** thumbnails) {
+  if (document == NULL || mupdf_document == NULL || pages == NULL || thumbnails == NULL || size == 0) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  thumbnail_batch_t batch = {
+      .mupdf_document  = mupdf_document,
+      .cache_directory = pdf_thumbnail_cache_directory(mupdf_document, zathura_document_get_path(document)),
+      .size            = size,
+      .pending         = 0,
+  };
+  g_mutex_init(&batch.mutex);
+  g_cond_init(&batch.cond);
+
+  /* pages are interpreted one at a time under the document mutex, but rasterized in parallel */
+  thumbnail_task_t* tasks = g_new0(thumbnail_task_t, n_pages);
+  GThreadPool* pool       = pdf_thumbnail_get_pool(mupdf_document);
+  for (unsigned int i = 0; i < n_pages; i++) {
+    tasks[i].batch     = &batch;
+    tasks[i].page      = pages[i];
+    tasks[i].thumbnail = &thumbnails[i];
+    thumbnails[i]      = NULL;
+
+    g_mutex_lock(&batch.mutex);
+    batch.pending++;
+    g_mutex_unlock(&batch.mutex);
+
+    if (pool == NULL || g_thread_pool_push(pool, &tasks[i], NULL) == FALSE) {
+      pdf_thumbnail_worker(&tasks[i], NULL);
+    }
+  }
+
+  g_mutex_lock(&batch.mutex);
+  while (batch.pending > 0) {
+    g_cond_wait(&batch.cond, &batch.mutex);
+  }
+  g_mutex_unlock(&batch.mutex);
+
+  g_free(tasks);
+  g_cond_clear(&batch.cond);
+  g_mutex_clear(&batch.mutex);
+  g_free(batch.cache_directory);
+
+  unsigned int rendered = 0;
+  for (unsigned int i = 0; i < n_pages; i++) {
+    rendered += thumbnails[i] != NULL;
+  }
+
+  return rendered > 0 || n_pages == 0 ? ZATHURA_ERROR_OK : ZATHURA_ERROR_UNKNOWN;
+}
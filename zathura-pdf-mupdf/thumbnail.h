@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: Zlib */
+
+#ifndef THUMBNAIL_H
+#define THUMBNAIL_H
+
+#include "plugin.h"
+
+/**
+ * Renders thumbnails of several pages in parallel. Embedded /Thumb images are
+ * used when they are large enough, other pages are rendered with images
+ * decoded at the size they are drawn at. If ZATHURA_MUPDF_THUMBNAIL_CACHE is
+ * set, thumbnails are cached on disk next to the text index unless the
+ * document has unsaved changes. Zathura has no
+ * thumbnail hook, so this is a batch interface for callers that link the
+ * plugin, such as the bench; embedded /Thumb images may be stale and lack
+ * annotations, so the normal render hook does not use it.
+ *
+ * @param document Zathura document
+ * @param mupdf_document Mupdf document
+ * @param pages Pages of the thumbnails
+ * @param n_pages Number of pages
+ * @param size Edge length of the box the thumbnails are fitted into
+ * @param thumbnails Array of n_pages that receives the cairo image surfaces;
+ *   the entries of pages that failed are set to NULL
+ * @return ZATHURA_ERROR_OK if at least one thumbnail was rendered, otherwise
+ *    see zathura_error_t
+ */
+zathura_error_t mupdf_document_render_thumbnails(zathura_document_t* document, mupdf_document_t* mupdf_document,
+                                                zathura_page_t** pages, unsigned int n_pages, unsigned int size,
+                                                cairo_surface_t** thumbnails);
+
+#endif // THUMBNAIL_H
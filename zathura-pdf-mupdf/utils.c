@@ -1,26 +1,1143 @@
 /* SPDX-License-Identifier: Zlib */
 
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <girara/utils.h>
+#include <mupdf/pdf.h>
+
+#include "alloc.h"
+#include "convert.h"
 #include "utils.h"
 
-void mupdf_page_extract_text(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page) {
-  if (mupdf_document == NULL || mupdf_document->ctx == NULL || mupdf_page == NULL || mupdf_page->text == NULL) {
+/* a resolved internal link target */
+typedef struct mupdf_destination_s {
+  int page_number;
+  float x; /**< NAN if the target keeps the horizontal position */
+  float y; /**< NAN if the target keeps the vertical position */
+} mupdf_destination_t;
+
+/* edge length in points of the cells annotations are looked up in */
+#define ANNOTATION_CELL_SIZE 32
+
+/* a note or markup annotation in the grid of its page */
+typedef struct mupdf_annotation_entry_s {
+  pdf_annot* annot;         /**< The annotation, owned by the loaded page */
+  enum pdf_annot_type type; /**< Type of the annotation */
+  fz_point anchor;          /**< Top left corner the annotation is looked up by */
+} mupdf_annotation_entry_t;
+
+/* a context of one thread for one document, owned by the thread's list and referenced by the document's set */
+typedef struct mupdf_thread_context_s {
+  mupdf_document_t* mupdf_document; /**< Document, NULL once the document dropped its contexts */
+  fz_context* ctx;                  /**< Clone of the document's context, or the base context itself */
+} mupdf_thread_context_t;
+
+/* guards the documents of all thread contexts, taken before the contexts mutex of a document */
+static GMutex mupdf_thread_contexts_mutex;
+
+static void mupdf_thread_contexts_free(gpointer data);
+
+/* the contexts of the calling thread; threads retired by a pool drop them when they exit */
+static GPrivate mupdf_thread_contexts = G_PRIVATE_INIT(mupdf_thread_contexts_free);
+
+/* called with mupdf_thread_contexts_mutex held */
+static GSList* mupdf_thread_context_attach(GSList* entries, mupdf_document_t* mupdf_document, fz_context* ctx) {
+  mupdf_thread_context_t* entry = g_new(mupdf_thread_context_t, 1);
+  entry->mupdf_document         = mupdf_document;
+  entry->ctx                    = ctx;
+
+  g_mutex_lock(&mupdf_document->contexts_mutex);
+  g_hash_table_add(mupdf_document->contexts, entry);
+  g_mutex_unlock(&mupdf_document->contexts_mutex);
+
+  return g_slist_prepend(entries, entry);
+}
+
+static void mupdf_thread_contexts_free(gpointer data) {
+  GSList* entries = data;
+
+  g_mutex_lock(&mupdf_thread_contexts_mutex);
+  for (GSList* link = entries; link != NULL; link = link->next) {
+    mupdf_thread_context_t* entry    = link->data;
+    mupdf_document_t* mupdf_document = entry->mupdf_document;
+    if (mupdf_document == NULL) {
+      continue;
+    }
+
+    g_mutex_lock(&mupdf_document->contexts_mutex);
+    g_hash_table_remove(mupdf_document->contexts, entry);
+    g_mutex_unlock(&mupdf_document->contexts_mutex);
+
+    /* the base context is dropped together with the document */
+    if (entry->ctx != mupdf_document->ctx) {
+      fz_drop_context(entry->ctx);
+    }
+  }
+  g_mutex_unlock(&mupdf_thread_contexts_mutex);
+
+  g_slist_free_full(entries, g_free);
+}
+
+fz_context* mupdf_document_get_context(mupdf_document_t* mupdf_document) {
+  if (mupdf_document == NULL || mupdf_document->ctx == NULL) {
+    return NULL;
+  }
+
+  GSList* entries = g_private_get(&mupdf_thread_contexts);
+  fz_context* ctx = NULL;
+
+  g_mutex_lock(&mupdf_thread_contexts_mutex);
+  for (GSList* link = entries; link != NULL;) {
+    GSList* next                  = link->next;
+    mupdf_thread_context_t* entry = link->data;
+    if (entry->mupdf_document == mupdf_document) {
+      ctx = entry->ctx;
+    } else if (entry->mupdf_document == NULL) {
+      /* left behind by a document that was freed */
+      entries = g_slist_delete_link(entries, link);
+      g_free(entry);
+    }
+    link = next;
+  }
+
+  if (ctx == NULL) {
+    ctx = fz_clone_context(mupdf_document->ctx);
+    if (ctx != NULL) {
+      entries = mupdf_thread_context_attach(entries, mupdf_document, ctx);
+    }
+  }
+  g_mutex_unlock(&mupdf_thread_contexts_mutex);
+
+  g_private_set(&mupdf_thread_contexts, entries);
+
+  return ctx;
+}
+
+void mupdf_document_set_context(mupdf_document_t* mupdf_document, fz_context* ctx) {
+  GSList* entries = g_private_get(&mupdf_thread_contexts);
+
+  g_mutex_lock(&mupdf_thread_contexts_mutex);
+  entries = mupdf_thread_context_attach(entries, mupdf_document, ctx);
+  g_mutex_unlock(&mupdf_thread_contexts_mutex);
+
+  g_private_set(&mupdf_thread_contexts, entries);
+}
+
+void mupdf_document_drop_contexts(mupdf_document_t* mupdf_document) {
+  if (mupdf_document == NULL || mupdf_document->contexts == NULL) {
     return;
   }
 
+  /* the entries stay in the lists of their threads, which free them */
+  g_mutex_lock(&mupdf_thread_contexts_mutex);
+  g_mutex_lock(&mupdf_document->contexts_mutex);
+  GHashTableIter iter;
+  gpointer key = NULL;
+  g_hash_table_iter_init(&iter, mupdf_document->contexts);
+  while (g_hash_table_iter_next(&iter, &key, NULL) == TRUE) {
+    mupdf_thread_context_t* entry = key;
+    /* the base context is dropped last by the caller */
+    if (entry->ctx != mupdf_document->ctx) {
+      fz_drop_context(entry->ctx);
+    }
+    entry->mupdf_document = NULL;
+    entry->ctx            = NULL;
+  }
+  g_hash_table_remove_all(mupdf_document->contexts);
+  g_mutex_unlock(&mupdf_document->contexts_mutex);
+  g_mutex_unlock(&mupdf_thread_contexts_mutex);
+}
+
+void mupdf_document_lock(mupdf_document_t* mupdf_document) {
+  mupdf_stats_t* stats = &mupdf_document->stats;
+  if (stats->enabled == false) {
+    g_mutex_lock(&mupdf_document->mutex);
+    return;
+  }
+
+  gint64 start = mupdf_stats_start(stats);
+  g_mutex_lock(&mupdf_document->mutex);
+  mupdf_stats_stop(stats, MUPDF_STATS_LOCK_WAIT, start);
+  stats->locked_at = mupdf_stats_start(stats);
+}
+
+void mupdf_document_unlock(mupdf_document_t* mupdf_document) {
+  mupdf_stats_t* stats = &mupdf_document->stats;
+  if (stats->enabled == true) {
+    mupdf_stats_stop(stats, MUPDF_STATS_LOCK_HOLD, stats->locked_at);
+  }
+
+  g_mutex_unlock(&mupdf_document->mutex);
+}
+
+size_t mupdf_getenv_size(const char* name, size_t fallback) {
+  const char* value = g_getenv(name);
+  if (value == NULL || value[0] == '\0') {
+    return fallback;
+  }
+
+  char* end    = NULL;
+  errno        = 0;
+  guint64 size = g_ascii_strtoull(value, &end, 10);
+  if (end == value || errno == ERANGE) {
+    return fallback;
+  }
+
+  unsigned int shift = 0;
+  switch (g_ascii_tolower(*end)) {
+    case 'g':
+      shift += 10;
+      /* fall through */
+    case 'm':
+      shift += 10;
+      /* fall through */
+    case 'k':
+      shift += 10;
+      end++;
+      break;
+    default:
+      break;
+  }
+
+  /* sizes that do not fit are rejected instead of wrapping around */
+  if (*end != '\0' || size > (SIZE_MAX >> shift)) {
+    return fallback;
+  }
+
+  return (size_t)size << shift;
+}
+
+unsigned int mupdf_getenv_uint(const char* name, unsigned int fallback) {
+  const char* value = g_getenv(name);
+  if (value == NULL || value[0] == '\0') {
+    return fallback;
+  }
+
+  char* end      = NULL;
+  guint64 number = g_ascii_strtoull(value, &end, 10);
+  if (*end != '\0' || number > G_MAXUINT) {
+    return fallback;
+  }
+
+  return number;
+}
+
+fz_page* mupdf_page_get_page(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page, fz_context* ctx) {
+  if (mupdf_page->page != NULL) {
+    mupdf_cache_touch(&mupdf_document->pages, &mupdf_page->page_entry);
+    return mupdf_page->page;
+  }
+
+  fz_try(ctx) {
+    mupdf_page->page = fz_load_page(ctx, mupdf_document->document, mupdf_page->index);
+  }
+  fz_catch(ctx) {
+    return NULL;
+  }
+
+  mupdf_cache_insert(&mupdf_document->pages, &mupdf_page->page_entry, 1, ctx);
+
+  return mupdf_page->page;
+}
+
+bool mupdf_page_evict_page(void* data, mupdf_cache_entry_t* entry) {
+  fz_context* ctx          = data;
+  mupdf_page_t* mupdf_page = mupdf_cache_entry_owner(entry, mupdf_page_t, page_entry);
+
+  /* the page is only used under the document mutex, which the caller holds */
+  mupdf_page_drop_annotation_index(mupdf_page);
+  fz_drop_page(ctx, mupdf_page->page);
+  mupdf_page->page = NULL;
+
+  return true;
+}
+
+fz_display_list* mupdf_page_get_display_list(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+                                             fz_context* ctx, fz_cookie* cookie) {
+  if (mupdf_page->display_list != NULL) {
+    mupdf_cache_touch(&mupdf_document->display_lists, &mupdf_page->display_list_entry);
+    return fz_keep_display_list(ctx, mupdf_page->display_list);
+  }
+
+  fz_display_list* volatile display_list = NULL;
+  fz_device* volatile device             = NULL;
+
+  /* the allocations that survive the interpretation are accounted to the list */
+  ptrdiff_t balance = mupdf_alloc_thread_balance();
+
+  mupdf_document_lock(mupdf_document);
+  fz_page* page = mupdf_page_get_page(mupdf_document, mupdf_page, ctx);
+  if (page == NULL) {
+    mupdf_document_unlock(mupdf_document);
+    return NULL;
+  }
+
+  gint64 start = mupdf_stats_start(&mupdf_document->stats);
+  fz_try(ctx) {
+    display_list = fz_new_display_list(ctx, mupdf_page->bbox);
+    device       = fz_new_list_device(ctx, display_list);
+    fz_run_page(ctx, page, device, fz_identity, cookie);
+    fz_close_device(ctx, device);
+  }
+  fz_always(ctx) {
+    fz_drop_device(ctx, device);
+  }
+  fz_catch(ctx) {
+    fz_drop_display_list(ctx, display_list);
+    display_list = NULL;
+  }
+  mupdf_stats_stop(&mupdf_document->stats, MUPDF_STATS_INTERPRET, start);
+  mupdf_document_unlock(mupdf_document);
+
+  if (display_list == NULL) {
+    return NULL;
+  }
+
+  /* the interpretation stopped early, so the list misses parts of the page */
+  if (cookie != NULL && cookie->abort != 0) {
+    fz_drop_display_list(ctx, display_list);
+    return NULL;
+  }
+
+  ptrdiff_t size           = mupdf_alloc_thread_balance() - balance;
+  mupdf_page->display_list = display_list;
+  mupdf_stats_add_bytes(&mupdf_document->stats, MUPDF_STATS_DISPLAY_LIST_BYTES, size > 0 ? (size_t)size : 0);
+  mupdf_cache_insert(&mupdf_document->display_lists, &mupdf_page->display_list_entry, size > 0 ? (size_t)size : 0,
+                     ctx);
+  mupdf_stats_sample_memory(mupdf_document);
+
+  return fz_keep_display_list(ctx, display_list);
+}
+
+bool mupdf_page_evict_display_list(void* data, mupdf_cache_entry_t* entry) {
+  fz_context* ctx          = data;
+  mupdf_page_t* mupdf_page = mupdf_cache_entry_owner(entry, mupdf_page_t, display_list_entry);
+
+  if (g_mutex_trylock(&mupdf_page->mutex) == FALSE) {
+    return false;
+  }
+
+  /* renders in progress hold their own reference */
+  fz_drop_display_list(ctx, mupdf_page->display_list);
+  mupdf_page->display_list = NULL;
+  g_mutex_unlock(&mupdf_page->mutex);
+
+  return true;
+}
+
+void mupdf_page_invalidate(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page) {
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL || mupdf_page == NULL) {
+    return;
+  }
+
+  g_mutex_lock(&mupdf_page->mutex);
+  mupdf_cache_remove(&mupdf_document->display_lists, &mupdf_page->display_list_entry);
+  fz_drop_display_list(ctx, mupdf_page->display_list);
+  mupdf_page->display_list = NULL;
+  mupdf_page_drop_images(mupdf_page, ctx);
+  g_mutex_unlock(&mupdf_page->mutex);
+  mupdf_rasters_invalidate(&mupdf_document->rasters, mupdf_page->index);
+
+  mupdf_document_lock(mupdf_document);
+  mupdf_page_drop_links(mupdf_page);
+  mupdf_document_unlock(mupdf_document);
+}
+
+fz_stext_page* mupdf_page_get_text(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page) {
+  if (mupdf_document == NULL || mupdf_document->ctx == NULL || mupdf_page == NULL) {
+    return NULL;
+  }
+
+  if (mupdf_page->extracted_text == true) {
+    mupdf_cache_touch(&mupdf_document->texts, &mupdf_page->text_entry);
+    return mupdf_page->text;
+  }
+
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    return NULL;
+  }
+
+  fz_stext_page* volatile text    = NULL;
   fz_device* volatile text_device = NULL;
+  fz_page* page                   = NULL;
+
+  /* a cached display list saves interpreting the page again */
+  fz_display_list* display_list = mupdf_page->display_list;
+  if (display_list != NULL) {
+    mupdf_cache_touch(&mupdf_document->display_lists, &mupdf_page->display_list_entry);
+  } else {
+    mupdf_document_lock(mupdf_document);
+    page = mupdf_page_get_page(mupdf_document, mupdf_page, ctx);
+    if (page == NULL) {
+      mupdf_document_unlock(mupdf_document);
+      return NULL;
+    }
+  }
+
+  /* the allocations that survive the extraction are accounted to the text */
+  ptrdiff_t balance = mupdf_alloc_thread_balance();
+  gint64 start      = mupdf_stats_start(&mupdf_document->stats);
+
+  fz_try(ctx) {
+    text = fz_new_stext_page(ctx, mupdf_page->bbox);
+
+    /* images are collected by mupdf_page_get_images, the text layer does not keep them */
+    fz_stext_options stext_options = {0};
+    text_device                    = fz_new_stext_device(ctx, text, &stext_options);
+
+    if (display_list != NULL) {
+      fz_run_display_list(ctx, display_list, text_device, fz_identity, fz_infinite_rect, NULL);
+    } else {
+      fz_run_page(ctx, page, text_device, fz_identity, NULL);
+    }
+  }
+  fz_always(ctx) {
+    fz_close_device(ctx, text_device);
+    fz_drop_device(ctx, text_device);
+  }
+  fz_catch(ctx) {}
+  mupdf_stats_stop(&mupdf_document->stats, MUPDF_STATS_TEXT, start);
+
+  if (display_list == NULL) {
+    mupdf_document_unlock(mupdf_document);
+  }
+
+  /* text up to a broken content stream is kept */
+  if (text != NULL) {
+    ptrdiff_t size             = mupdf_alloc_thread_balance() - balance;
+    mupdf_page->text           = text;
+    mupdf_page->extracted_text = true;
+    mupdf_stats_add_bytes(&mupdf_document->stats, MUPDF_STATS_TEXT_BYTES, size > 0 ? (size_t)size : 0);
+    mupdf_cache_insert(&mupdf_document->texts, &mupdf_page->text_entry, size > 0 ? (size_t)size : 0, ctx);
+    mupdf_stats_sample_memory(mupdf_document);
+  }
+
+  return text;
+}
+
+mupdf_text_lines_t* mupdf_page_get_text_lines(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page) {
+  fz_stext_page* text = mupdf_page_get_text(mupdf_document, mupdf_page);
+  if (text == NULL) {
+    return NULL;
+  }
+
+  if (mupdf_page->text_lines == NULL) {
+    mupdf_page->text_lines = mupdf_text_lines_new(text);
+  }
+
+  return mupdf_page->text_lines;
+}
+
+bool mupdf_page_evict_text(void* data, mupdf_cache_entry_t* entry) {
+  fz_context* ctx          = data;
+  mupdf_page_t* mupdf_page = mupdf_cache_entry_owner(entry, mupdf_page_t, text_entry);
+
+  if (g_mutex_trylock(&mupdf_page->mutex) == FALSE) {
+    return false;
+  }
+
+  mupdf_text_lines_free(mupdf_page->text_lines);
+  fz_drop_stext_page(ctx, mupdf_page->text);
+  mupdf_page->text_lines     = NULL;
+  mupdf_page->text           = NULL;
+  mupdf_page->extracted_text = false;
+  g_mutex_unlock(&mupdf_page->mutex);
+
+  return true;
+}
+
+/* a device that only records the images drawn through it */
+typedef struct mupdf_image_device_s {
+  fz_device super;
+  GArray* images;
+} mupdf_image_device_t;
+
+static void mupdf_image_device_fill_image(fz_context* ctx, fz_device* dev, fz_image* image, fz_matrix ctm,
+                                          float GIRARA_UNUSED(alpha), fz_color_params GIRARA_UNUSED(color_params)) {
+  mupdf_image_device_t* device = (mupdf_image_device_t*)dev;
+  mupdf_page_image_t entry     = {.bbox = fz_transform_rect(fz_unit_rect, ctm), .image = fz_keep_image(ctx, image)};
+
+  g_array_append_val(device->images, entry);
+}
+
+GArray* mupdf_page_get_images(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page) {
+  if (mupdf_document == NULL || mupdf_document->ctx == NULL || mupdf_page == NULL) {
+    return NULL;
+  }
+
+  if (mupdf_page->images != NULL) {
+    return mupdf_page->images;
+  }
+
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    return NULL;
+  }
+
+  mupdf_image_device_t* volatile device = NULL;
+  fz_page* page                         = NULL;
+
+  /* a cached display list saves interpreting the page again */
+  fz_display_list* display_list = mupdf_page->display_list;
+  if (display_list != NULL) {
+    mupdf_cache_touch(&mupdf_document->display_lists, &mupdf_page->display_list_entry);
+  } else {
+    mupdf_document_lock(mupdf_document);
+    page = mupdf_page_get_page(mupdf_document, mupdf_page, ctx);
+    if (page == NULL) {
+      mupdf_document_unlock(mupdf_document);
+      return NULL;
+    }
+  }
+
+  GArray* images = g_array_new(FALSE, FALSE, sizeof(mupdf_page_image_t));
+
+  fz_try(ctx) {
+    device                   = fz_new_derived_device(ctx, mupdf_image_device_t);
+    device->super.fill_image = mupdf_image_device_fill_image;
+    device->images           = images;
+
+    if (display_list != NULL) {
+      fz_run_display_list(ctx, display_list, &device->super, fz_identity, fz_infinite_rect, NULL);
+    } else {
+      fz_run_page(ctx, page, &device->super, fz_identity, NULL);
+    }
+  }
+  fz_always(ctx) {
+    if (device != NULL) {
+      fz_close_device(ctx, &device->super);
+      fz_drop_device(ctx, &device->super);
+    }
+  }
+  /* images up to a broken content stream are kept */
+  fz_catch(ctx) {}
+
+  if (display_list == NULL) {
+    mupdf_document_unlock(mupdf_document);
+  }
+
+  mupdf_page->images = images;
+
+  return images;
+}
+
+void mupdf_page_drop_images(mupdf_page_t* mupdf_page, fz_context* ctx) {
+  if (mupdf_page->images == NULL) {
+    return;
+  }
+
+  for (guint i = 0; i < mupdf_page->images->len; i++) {
+    fz_drop_image(ctx, g_array_index(mupdf_page->images, mupdf_page_image_t, i).image);
+  }
+  g_array_free(mupdf_page->images, TRUE);
+  mupdf_page->images = NULL;
+}
+
+zathura_link_type_t mupdf_document_resolve_link(mupdf_document_t* mupdf_document, fz_context* ctx, const char* uri,
+                                                zathura_link_target_t* target) {
+  *target = (zathura_link_target_t){ZATHURA_LINK_DESTINATION_UNKNOWN, NULL, 0, -1, -1, -1, -1, 0};
+
+  if (uri == NULL) {
+    return ZATHURA_LINK_NONE;
+  }
+
+  if (fz_is_external_link(ctx, uri) == 1) {
+    target->value = (char*)uri;
+    return strstr(uri, "file://") == uri ? ZATHURA_LINK_GOTO_REMOTE : ZATHURA_LINK_URI;
+  }
+
+  if (mupdf_document->destinations == NULL) {
+    mupdf_document->destinations = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  }
+
+  mupdf_destination_t* destination = g_hash_table_lookup(mupdf_document->destinations, uri);
+  if (destination == NULL) {
+    float x         = 0;
+    float y         = 0;
+    int page_number = -1;
+    fz_try(ctx) {
+      fz_location location = fz_resolve_link(ctx, mupdf_document->document, uri, &x, &y);
+      page_number          = fz_page_number_from_location(ctx, mupdf_document->document, location);
+    }
+    fz_catch(ctx) {
+      return ZATHURA_LINK_INVALID;
+    }
 
-  fz_try(mupdf_page->ctx) {
-    fz_stext_options stext_options;
-    stext_options.flags = FZ_STEXT_PRESERVE_IMAGES;
-    text_device         = fz_new_stext_device(mupdf_page->ctx, mupdf_page->text, &stext_options);
+    destination              = g_new(mupdf_destination_t, 1);
+    destination->page_number = page_number;
+    destination->x           = x;
+    destination->y           = y;
+    g_hash_table_insert(mupdf_document->destinations, g_strdup(uri), destination);
+  }
+
+  target->destination_type = ZATHURA_LINK_DESTINATION_XYZ;
+  target->page_number      = destination->page_number;
+  if (!isnan(destination->x)) {
+    target->left = destination->x;
+  }
+  if (!isnan(destination->y)) {
+    target->top = destination->y;
+  }
+  target->zoom = 0.0;
+
+  return ZATHURA_LINK_GOTO_DEST;
+}
+
+GArray* mupdf_page_get_links(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page, fz_context* ctx) {
+  if (mupdf_page->links != NULL) {
+    return mupdf_page->links;
+  }
+
+  fz_page* page = mupdf_page_get_page(mupdf_document, mupdf_page, ctx);
+  if (page == NULL) {
+    return NULL;
+  }
+
+  fz_link* volatile links = NULL;
+  fz_try(ctx) {
+    links = fz_load_links(ctx, page);
+  }
+  fz_catch(ctx) {
+    return NULL;
+  }
+
+  /* the targets are copied, so that the links can be dropped right away */
+  GArray* array = g_array_new(FALSE, FALSE, sizeof(mupdf_page_link_t));
+  for (fz_link* link = links; link != NULL; link = link->next) {
+    mupdf_page_link_t entry = {
+        .position = {.x1 = link->rect.x0, .y1 = link->rect.y0, .x2 = link->rect.x1, .y2 = link->rect.y1},
+    };
+    entry.type         = mupdf_document_resolve_link(mupdf_document, ctx, link->uri, &entry.target);
+    entry.target.value = g_strdup(entry.target.value);
+    g_array_append_val(array, entry);
+  }
+  fz_drop_link(ctx, links);
+
+  mupdf_page->links = array;
+
+  return array;
+}
+
+void mupdf_page_drop_links(mupdf_page_t* mupdf_page) {
+  if (mupdf_page->links == NULL) {
+    return;
+  }
+
+  for (guint i = 0; i < mupdf_page->links->len; i++) {
+    g_free(g_array_index(mupdf_page->links, mupdf_page_link_t, i).target.value);
+  }
+  g_array_free(mupdf_page->links, TRUE);
+  mupdf_page->links = NULL;
+}
+
+/* computes where an annotation is kept in the grid, false if it is neither a note nor a markup */
+static bool mupdf_annotation_get_anchor(fz_context* ctx, pdf_annot* annot, enum pdf_annot_type* type,
+                                        fz_point* anchor) {
+  *type = pdf_annot_type(ctx, annot);
+  if (*type == PDF_ANNOT_TEXT) {
+    fz_rect rect = pdf_annot_rect(ctx, annot);
+    *anchor      = fz_make_point(rect.x0, rect.y0);
+    return true;
+  }
+
+  if (*type != PDF_ANNOT_HIGHLIGHT && *type != PDF_ANNOT_UNDERLINE && *type != PDF_ANNOT_STRIKE_OUT) {
+    return false;
+  }
+
+  /* every quad of a match lies within the tolerance, and so does the corner of their union */
+  const int n_quads = pdf_annot_quad_point_count(ctx, annot);
+  fz_rect bounds    = fz_empty_rect;
+  for (int i = 0; i < n_quads; i++) {
+    bounds = fz_union_rect(bounds, fz_rect_from_quad(pdf_annot_quad_point(ctx, annot, i)));
+  }
+  if (n_quads == 0) {
+    bounds = pdf_annot_rect(ctx, annot);
+  }
+  *anchor = fz_make_point(bounds.x0, bounds.y0);
+
+  return true;
+}
+
+static gpointer mupdf_annotation_cell(float x, float y) {
+  /* distant cells may share a key, the anchors are compared anyway */
+  const guint cx = (guint)(int)CLAMP(floorf(x / ANNOTATION_CELL_SIZE), G_MININT16, G_MAXINT16) & 0xffff;
+  const guint cy = (guint)(int)CLAMP(floorf(y / ANNOTATION_CELL_SIZE), G_MININT16, G_MAXINT16) & 0xffff;
+  return GUINT_TO_POINTER(cx << 16 | cy);
+}
+
+static void mupdf_annotation_add(GHashTable* grid, pdf_annot* annot, enum pdf_annot_type type, fz_point anchor) {
+  gpointer key = mupdf_annotation_cell(anchor.x, anchor.y);
+  GArray* cell = g_hash_table_lookup(grid, key);
+  if (cell == NULL) {
+    cell = g_array_new(FALSE, FALSE, sizeof(mupdf_annotation_entry_t));
+    g_hash_table_insert(grid, key, cell);
+  }
+
+  mupdf_annotation_entry_t entry = {.annot = annot, .type = type, .anchor = anchor};
+  g_array_append_val(cell, entry);
+}
+
+static GHashTable* mupdf_page_get_annotation_index(mupdf_page_t* mupdf_page, fz_context* ctx, pdf_page* page) {
+  if (mupdf_page->annotations != NULL) {
+    return mupdf_page->annotations;
+  }
+
+  GHashTable* volatile grid = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)g_array_unref);
+  fz_try(ctx) {
+    for (pdf_annot* annot = pdf_first_annot(ctx, page); annot != NULL; annot = pdf_next_annot(ctx, annot)) {
+      enum pdf_annot_type type;
+      fz_point anchor;
+      if (mupdf_annotation_get_anchor(ctx, annot, &type, &anchor) == true) {
+        mupdf_annotation_add(grid, annot, type, anchor);
+      }
+    }
+  }
+  fz_catch(ctx) {
+    g_hash_table_unref(grid);
+    fz_rethrow(ctx);
+  }
+
+  mupdf_page->annotations = grid;
+
+  return grid;
+}
+
+pdf_annot* mupdf_page_find_annotation(mupdf_page_t* mupdf_page, fz_context* ctx, pdf_page* page, unsigned int types,
+                                      fz_point anchor, mupdf_annotation_match_t matches, void* data) {
+  GHashTable* grid = mupdf_page_get_annotation_index(mupdf_page, ctx, page);
+
+  /* the tolerance is smaller than a cell, so at most four cells hold candidates */
+  const float eps = ANNOTATION_MATCH_EPS;
+  float xs[2]     = {anchor.x - eps, anchor.x + eps};
+  float ys[2]     = {anchor.y - eps, anchor.y + eps};
+  gpointer visited[4];
+  unsigned int n_visited = 0;
+
+  for (unsigned int i = 0; i < 4; i++) {
+    gpointer key = mupdf_annotation_cell(xs[i & 1], ys[i >> 1]);
+    bool seen    = false;
+    for (unsigned int v = 0; v < n_visited; v++) {
+      seen = seen || visited[v] == key;
+    }
+    if (seen == true) {
+      continue;
+    }
+    visited[n_visited++] = key;
+
+    GArray* cell = g_hash_table_lookup(grid, key);
+    if (cell == NULL) {
+      continue;
+    }
+
+    for (guint j = 0; j < cell->len; j++) {
+      mupdf_annotation_entry_t* entry = &g_array_index(cell, mupdf_annotation_entry_t, j);
+      if ((types & (1u << entry->type)) == 0 || fabsf(entry->anchor.x - anchor.x) >= eps ||
+          fabsf(entry->anchor.y - anchor.y) >= eps) {
+        continue;
+      }
+      if (matches == NULL || matches(ctx, entry->annot, data) == true) {
+        return entry->annot;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+void mupdf_page_index_annotation(mupdf_page_t* mupdf_page, fz_context* ctx, pdf_annot* annot) {
+  if (mupdf_page->annotations == NULL) {
+    return;
+  }
 
-    fz_run_page(mupdf_page->ctx, mupdf_page->page, text_device, fz_identity, NULL);
+  enum pdf_annot_type type;
+  fz_point anchor;
+  if (mupdf_annotation_get_anchor(ctx, annot, &type, &anchor) == true) {
+    mupdf_annotation_add(mupdf_page->annotations, annot, type, anchor);
+  }
+}
+
+void mupdf_page_unindex_annotation(mupdf_page_t* mupdf_page, fz_context* ctx, pdf_annot* annot) {
+  if (mupdf_page->annotations == NULL) {
+    return;
+  }
+
+  enum pdf_annot_type type;
+  fz_point anchor;
+  if (mupdf_annotation_get_anchor(ctx, annot, &type, &anchor) == false) {
+    return;
   }
-  fz_always(mupdf_page->ctx) {
-    fz_close_device(mupdf_page->ctx, text_device);
-    fz_drop_device(mupdf_page->ctx, text_device);
+
+  GArray* cell = g_hash_table_lookup(mupdf_page->annotations, mupdf_annotation_cell(anchor.x, anchor.y));
+  if (cell == NULL) {
+    return;
+  }
+
+  for (guint i = 0; i < cell->len; i++) {
+    if (g_array_index(cell, mupdf_annotation_entry_t, i).annot == annot) {
+      g_array_remove_index_fast(cell, i);
+      break;
+    }
+  }
+}
+
+void mupdf_page_drop_annotation_index(mupdf_page_t* mupdf_page) {
+  if (mupdf_page->annotations == NULL) {
+    return;
+  }
+
+  g_hash_table_unref(mupdf_page->annotations);
+  mupdf_page->annotations = NULL;
+}
+
+/* creates the annotations of one batch and synthesizes their appearances, may throw */
+static void mupdf_annotation_batch_create(mupdf_annotation_batch_t* batch, fz_context* ctx, pdf_page* page,
+                                          mupdf_annotation_create_t create, GPtrArray* created) {
+  for (guint i = 0; i < batch->items->len; i++) {
+    pdf_annot* annot = create(ctx, page, g_ptr_array_index(batch->items, i));
+    if (annot != NULL) {
+      g_ptr_array_add(created, annot);
+    }
+  }
+
+  /* only the annotations without an appearance are updated */
+  pdf_update_page(ctx, page);
+
+  /* updating the appearance may move a note's rectangle, so they are indexed afterwards */
+  for (guint i = 0; i < created->len; i++) {
+    mupdf_page_index_annotation(batch->page, ctx, g_ptr_array_index(created, i));
+  }
+}
+
+zathura_error_t mupdf_document_create_annotations(mupdf_document_t* mupdf_document, mupdf_annotation_batch_t* batches,
+                                                  unsigned int n_batches, const char* operation,
+                                                  mupdf_annotation_create_t create) {
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  mupdf_document_lock(mupdf_document);
+
+  pdf_document* pdf_document = pdf_specifics(ctx, mupdf_document->document);
+  if (pdf_document == NULL) {
+    mupdf_document_unlock(mupdf_document);
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  /* the annotations of all pages are undone together */
+  fz_try(ctx) {
+    pdf_begin_operation(ctx, pdf_document, operation);
+  }
+  fz_catch(ctx) {
+    mupdf_document_unlock(mupdf_document);
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  zathura_error_t error = ZATHURA_ERROR_OK;
+  GPtrArray* created    = g_ptr_array_new();
+
+  for (unsigned int i = 0; i < n_batches; i++) {
+    mupdf_annotation_batch_t* batch = &batches[i];
+    batch->created                  = 0;
+    if (batch->items->len == 0) {
+      continue;
+    }
+
+    /* the page is only used until the next one is loaded */
+    pdf_page* page = pdf_page_from_fz_page(ctx, mupdf_page_get_page(mupdf_document, batch->page, ctx));
+    if (page == NULL) {
+      error = ZATHURA_ERROR_UNKNOWN;
+      continue;
+    }
+
+    fz_try(ctx) {
+      mupdf_annotation_batch_create(batch, ctx, page, create, created);
+    }
+    fz_always(ctx) {
+      for (guint j = 0; j < created->len; j++) {
+        pdf_drop_annot(ctx, g_ptr_array_index(created, j));
+      }
+      batch->created = created->len;
+      g_ptr_array_set_size(created, 0);
+    }
+    fz_catch(ctx) {
+      /* the grid may have missed some of the annotations, it is built again on the next lookup */
+      mupdf_page_drop_annotation_index(batch->page);
+      error = ZATHURA_ERROR_UNKNOWN;
+    }
+  }
+  g_ptr_array_free(created, TRUE);
+
+  fz_try(ctx) {
+    pdf_end_operation(ctx, pdf_document);
+  }
+  fz_catch(ctx) {
+    error = ZATHURA_ERROR_UNKNOWN;
+  }
+
+  mupdf_document_unlock(mupdf_document);
+
+  /* cached display lists still show the pages without the new annotations */
+  for (unsigned int i = 0; i < n_batches; i++) {
+    if (batches[i].created > 0) {
+      mupdf_page_invalidate(mupdf_document, batches[i].page);
+    }
+  }
+
+  return error;
+}
+
+static void mupdf_document_add_attachment(mupdf_document_t* mupdf_document, fz_context* ctx, pdf_obj* filespec) {
+  if (pdf_is_embedded_file(ctx, filespec) == 0) {
+    return;
+  }
+
+  pdf_filespec_params params;
+  pdf_get_filespec_params(ctx, filespec, &params);
+  if (params.filename == NULL || g_hash_table_contains(mupdf_document->attachments, params.filename) == TRUE) {
+    return;
+  }
+
+  gchar* name = g_strdup(params.filename);
+  g_ptr_array_add(mupdf_document->attachment_names, name);
+  g_hash_table_insert(mupdf_document->attachments, name, pdf_keep_obj(ctx, filespec));
+}
+
+bool mupdf_document_index_attachments(mupdf_document_t* mupdf_document, fz_context* ctx) {
+  if (mupdf_document->attachments != NULL) {
+    return true;
+  }
+
+  mupdf_document->attachment_names = g_ptr_array_new_with_free_func(g_free);
+  mupdf_document->attachments      = g_hash_table_new(g_str_hash, g_str_equal);
+
+  pdf_document* pdf_document = pdf_specifics(ctx, mupdf_document->document);
+  if (pdf_document == NULL) {
+    return true;
+  }
+
+  pdf_obj* volatile tree = NULL;
+  bool success           = true;
+  fz_try(ctx) {
+    tree        = pdf_load_name_tree(ctx, pdf_document, PDF_NAME(EmbeddedFiles));
+    const int n = pdf_dict_len(ctx, tree);
+    for (int i = 0; i < n; i++) {
+      mupdf_document_add_attachment(mupdf_document, ctx, pdf_dict_get_val(ctx, tree, i));
+    }
+
+    /* files that are only attached to annotations are not in the name tree */
+    if (mupdf_document->attachment_names->len == 0) {
+      const int n_objects = pdf_xref_len(ctx, pdf_document);
+      for (int i = 1; i < n_objects; i++) {
+        pdf_obj* volatile object = NULL;
+        fz_try(ctx) {
+          object = pdf_load_object(ctx, pdf_document, i);
+          mupdf_document_add_attachment(mupdf_document, ctx, object);
+        }
+        fz_always(ctx) {
+          pdf_drop_obj(ctx, object);
+        }
+        /* broken objects are skipped */
+        fz_catch(ctx) {}
+      }
+    }
+  }
+  fz_always(ctx) {
+    pdf_drop_obj(ctx, tree);
+  }
+  fz_catch(ctx) {
+    success = false;
+  }
+
+  /* a failed index is built again on the next use */
+  if (success == false) {
+    mupdf_document_drop_attachments(mupdf_document, ctx);
+  }
+
+  return success;
+}
+
+void mupdf_document_drop_attachments(mupdf_document_t* mupdf_document, fz_context* ctx) {
+  if (mupdf_document->attachments == NULL) {
+    return;
+  }
+
+  GHashTableIter iter;
+  gpointer filespec = NULL;
+  g_hash_table_iter_init(&iter, mupdf_document->attachments);
+  while (g_hash_table_iter_next(&iter, NULL, &filespec) == TRUE) {
+    pdf_drop_obj(ctx, filespec);
+  }
+  g_hash_table_unref(mupdf_document->attachments);
+  g_ptr_array_free(mupdf_document->attachment_names, TRUE);
+  mupdf_document->attachments      = NULL;
+  mupdf_document->attachment_names = NULL;
+}
+
+gchar* mupdf_document_get_cache_path(mupdf_document_t* mupdf_document, fz_context* ctx, const char* path,
+                                     const char* variant, const char* suffix) {
+  struct stat info;
+  if (path == NULL || stat(path, &info) != 0) {
+    return NULL;
+  }
+
+  GChecksum* checksum   = g_checksum_new(G_CHECKSUM_SHA256);
+  volatile bool have_id = false;
+
+  /* the first /ID string identifies the pdf independent of its location */
+  pdf_document* pdf_document = pdf_specifics(ctx, mupdf_document->document);
+  if (pdf_document != NULL) {
+    fz_try(ctx) {
+      pdf_obj* id    = pdf_dict_get(ctx, pdf_trailer(ctx, pdf_document), PDF_NAME(ID));
+      pdf_obj* first = pdf_array_get(ctx, id, 0);
+      if (pdf_is_string(ctx, first) != 0) {
+        g_checksum_update(checksum, (const guchar*)pdf_to_str_buf(ctx, first), pdf_to_str_len(ctx, first));
+        have_id = true;
+      }
+    }
+    fz_catch(ctx) {}
+  }
+
+  if (have_id == false) {
+    gchar* canonical = g_canonicalize_filename(path, NULL);
+    g_checksum_update(checksum, (const guchar*)canonical, -1);
+    g_free(canonical);
+  }
+
+  /* any change of the file invalidates the cached data */
+  gchar* stamp =
+      g_strdup_printf(":%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT "%s", (gint64)info.st_size, (gint64)info.st_mtime,
+                      variant != NULL ? variant : "");
+  g_checksum_update(checksum, (const guchar*)stamp, -1);
+  g_free(stamp);
+
+  gchar* cache_path = NULL;
+  char* xdg_path    = girara_get_xdg_path(XDG_CACHE);
+  if (xdg_path != NULL) {
+    gchar* filename = g_strconcat(g_checksum_get_string(checksum), suffix, NULL);
+    cache_path      = g_build_filename(xdg_path, "zathura", "mupdf", filename, NULL);
+    g_free(filename);
+    g_free(xdg_path);
+  }
+  g_checksum_free(checksum);
+
+  return cache_path;
+}
+
+/* returns the converter format of a pixmap's layout */
+static bool mupdf_pixmap_get_convert_format(fz_context* ctx, fz_pixmap* pixmap, mupdf_convert_format_t* format) {
+  fz_colorspace* colorspace = fz_pixmap_colorspace(ctx, pixmap);
+  const int n               = fz_pixmap_components(ctx, pixmap);
+  const int alpha           = fz_pixmap_alpha(ctx, pixmap);
+
+  if (fz_pixmap_spots(ctx, pixmap) > 0) {
+    return false;
+  }
+
+  /* masks have no colorspace and are shown as their coverage */
+  if (n == 1 && (colorspace == NULL || fz_colorspace_is_gray(ctx, colorspace))) {
+    *format = MUPDF_CONVERT_GRAY;
+  } else if (n == 3 && alpha == 0 && fz_colorspace_is_rgb(ctx, colorspace)) {
+    *format = MUPDF_CONVERT_RGB;
+  } else if (n == 4 && alpha == 1 && fz_colorspace_is_rgb(ctx, colorspace)) {
+    *format = MUPDF_CONVERT_RGBA;
+  } else if (n == 4 && alpha == 0 && fz_colorspace_is_cmyk(ctx, colorspace)) {
+    *format = MUPDF_CONVERT_CMYK;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+/* fits the image into the requested size, keeping its aspect ratio and never enlarging it */
+static void mupdf_image_fit(fz_image* image, int* width, int* height) {
+  double scale = 1.0;
+  if (*width > 0 && *width < image->w) {
+    scale = (double)*width / image->w;
+  }
+  if (*height > 0 && *height < image->h) {
+    scale = MIN(scale, (double)*height / image->h);
+  }
+
+  *width  = MAX(1, (int)(image->w * scale + 0.5));
+  *height = MAX(1, (int)(image->h * scale + 0.5));
+}
+
+cairo_surface_t* mupdf_image_get_cairo(fz_context* ctx, fz_image* image, int width, int height) {
+  fz_pixmap* volatile pixmap = NULL;
+  cairo_surface_t* surface   = NULL;
+
+  /* layouts without a converter are converted to RGB by mupdf first */
+  mupdf_convert_format_t format = MUPDF_CONVERT_GRAY;
+  const bool scale              = width > 0 || height > 0;
+  mupdf_image_fit(image, &width, &height);
+  fz_try(ctx) {
+    /* the matrix mapping the unit square to the target size lets mupdf subsample while decoding, e.g. by DCT
+     * scaling for JPEG and resolution levels for JPEG 2000; it may return more than requested */
+    fz_matrix ctm = fz_scale(width, height);
+    int full_w    = 0;
+    int full_h    = 0;
+    pixmap        = fz_get_pixmap_from_image(ctx, image, NULL, &ctm, &full_w, &full_h);
+    if (scale == true && (fz_pixmap_width(ctx, pixmap) != width || fz_pixmap_height(ctx, pixmap) != height)) {
+      /* if mupdf cannot scale, the decoded size is used */
+      fz_pixmap* scaled = fz_scale_pixmap(ctx, pixmap, 0, 0, width, height, NULL);
+      if (scaled != NULL) {
+        fz_drop_pixmap(ctx, pixmap);
+        pixmap = scaled;
+      }
+    }
+    if (mupdf_pixmap_get_convert_format(ctx, pixmap, &format) == false) {
+      fz_pixmap* rgb = fz_convert_pixmap(ctx, pixmap, fz_device_rgb(ctx), NULL, NULL, fz_default_color_params, 1);
+      fz_drop_pixmap(ctx, pixmap);
+      pixmap = rgb;
+      if (mupdf_pixmap_get_convert_format(ctx, pixmap, &format) == false) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "unsupported pixmap layout");
+      }
+    }
+  }
+  fz_catch(ctx) {
+    goto error_free;
+  }
+
+  height = fz_pixmap_height(ctx, pixmap);
+  width  = fz_pixmap_width(ctx, pixmap);
+
+  surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+  if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+    goto error_free;
+  }
+
+  cairo_surface_flush(surface);
+  unsigned char* surface_data = cairo_image_surface_get_data(surface);
+  const int rowstride         = cairo_image_surface_get_stride(surface);
+
+  const unsigned char* samples = fz_pixmap_samples(ctx, pixmap);
+  const ptrdiff_t stride       = fz_pixmap_stride(ctx, pixmap);
+  mupdf_convert_row_t convert  = mupdf_convert_get_row(format);
+  for (int y = 0; y < height; y++) {
+    convert(samples + y * stride, surface_data + (ptrdiff_t)y * rowstride, width);
+  }
+  cairo_surface_mark_dirty(surface);
+
+  fz_drop_pixmap(ctx, pixmap);
+
+  return surface;
+
+error_free:
+
+  if (pixmap != NULL) {
+    fz_drop_pixmap(ctx, pixmap);
+  }
+
+  if (surface != NULL) {
+    cairo_surface_destroy(surface);
   }
-  fz_catch(mupdf_page->ctx) {}
 
-  mupdf_page->extracted_text = true;
+  return NULL;
 }
@@ -3,8 +3,356 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <mupdf/pdf.h>
+
 #include "plugin.h"
 
-void mupdf_page_extract_text(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page);
+/* tolerance in points when annotations are looked up by position */
+#define ANNOTATION_MATCH_EPS 1.0
+
+/**
+ * Returns the calling thread's clone of the document context. The clone is
+ * created on first use and dropped when the thread exits or together with the
+ * document, whichever comes first.
+ *
+ * @param mupdf_document Mupdf document
+ * @return The context or NULL if an error occurred
+ */
+fz_context* mupdf_document_get_context(mupdf_document_t* mupdf_document);
+
+/**
+ * Makes the base context of the document the context of the calling thread,
+ * so that the opening thread does not clone it
+ *
+ * @param mupdf_document Mupdf document
+ * @param ctx The base context, dropped by the caller after
+ *   mupdf_document_drop_contexts
+ */
+void mupdf_document_set_context(mupdf_document_t* mupdf_document, fz_context* ctx);
+
+/**
+ * Drops all cloned contexts of the document
+ *
+ * @param mupdf_document Mupdf document
+ */
+void mupdf_document_drop_contexts(mupdf_document_t* mupdf_document);
+
+/**
+ * Takes the document mutex, accounting the time spent waiting for and holding
+ * it if statistics are enabled
+ *
+ * @param mupdf_document Mupdf document
+ */
+void mupdf_document_lock(mupdf_document_t* mupdf_document);
+
+/**
+ * Releases the document mutex taken by mupdf_document_lock
+ *
+ * @param mupdf_document Mupdf document
+ */
+void mupdf_document_unlock(mupdf_document_t* mupdf_document);
+
+/**
+ * Reads a size in bytes from the environment. The value may carry a K, M or G
+ * suffix; values that do not fit into a size_t are invalid.
+ *
+ * @param name Name of the environment variable
+ * @param fallback Value used if the variable is unset or invalid
+ * @return The size
+ */
+size_t mupdf_getenv_size(const char* name, size_t fallback);
+
+/**
+ * Reads an unsigned number from the environment
+ *
+ * @param name Name of the environment variable
+ * @param fallback Value used if the variable is unset or invalid
+ * @return The number
+ */
+unsigned int mupdf_getenv_uint(const char* name, unsigned int fallback);
+
+/**
+ * Returns the mupdf page, loading it on first use. Loaded pages are kept in
+ * mupdf_document_t::pages. Has to be called with the document mutex held, the
+ * page stays valid until the mutex is released.
+ *
+ * @param mupdf_document Mupdf document
+ * @param mupdf_page Mupdf page
+ * @param ctx Context of the calling thread
+ * @return The page or NULL if an error occurred
+ */
+fz_page* mupdf_page_get_page(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page, fz_context* ctx);
+
+/**
+ * Evicts the loaded page from mupdf_document_t::pages
+ *
+ * @param data Context of the calling thread
+ * @param entry mupdf_page_t::page_entry
+ * @return true if the page was dropped
+ */
+bool mupdf_page_evict_page(void* data, mupdf_cache_entry_t* entry);
+
+/**
+ * Returns the display list of a page, interpreting the page on first use.
+ * Has to be called with the page mutex held.
+ *
+ * @param mupdf_document Mupdf document
+ * @param mupdf_page Mupdf page
+ * @param ctx Context of the calling thread
+ * @param cookie Cookie to abort the interpretation with or NULL; an aborted
+ *   display list is not kept
+ * @return A new reference to the display list or NULL if an error occurred
+ */
+fz_display_list* mupdf_page_get_display_list(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+                                             fz_context* ctx, fz_cookie* cookie);
+
+/**
+ * Evicts the display list of a page from mupdf_document_t::display_lists
+ *
+ * @param data Context of the calling thread
+ * @param entry mupdf_page_t::display_list_entry
+ * @return true if the display list was dropped
+ */
+bool mupdf_page_evict_display_list(void* data, mupdf_cache_entry_t* entry);
+
+/**
+ * Drops all cached rendering state of a page after its contents changed. Has to
+ * be called without holding the page or document mutex.
+ *
+ * @param mupdf_document Mupdf document
+ * @param mupdf_page Mupdf page
+ */
+void mupdf_page_invalidate(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page);
+
+/**
+ * Returns the text of a page, extracting it on first use. Extracted text is
+ * kept in mupdf_document_t::texts. Has to be called with the page mutex held,
+ * the document mutex is taken while the page is interpreted.
+ *
+ * @param mupdf_document Mupdf document
+ * @param mupdf_page Mupdf page
+ * @return The text or NULL if an error occurred
+ */
+fz_stext_page* mupdf_page_get_text(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page);
+
+/**
+ * Returns the lines of a page's text indexed by their position, extracting the
+ * text and indexing its lines on first use. Has to be called with the page
+ * mutex held.
+ *
+ * @param mupdf_document Mupdf document
+ * @param mupdf_page Mupdf page
+ * @return The lines or NULL if an error occurred
+ */
+mupdf_text_lines_t* mupdf_page_get_text_lines(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page);
+
+/**
+ * Evicts the text of a page from mupdf_document_t::texts, the text is extracted
+ * again on its next use
+ *
+ * @param data Context of the calling thread
+ * @param entry mupdf_page_t::text_entry
+ * @return true if the text was dropped
+ */
+bool mupdf_page_evict_text(void* data, mupdf_cache_entry_t* entry);
+
+/**
+ * Returns the images drawn on a page, collecting them on first use without
+ * extracting the page text. Has to be called with the page mutex held, the
+ * document mutex is taken while the page is interpreted.
+ *
+ * @param mupdf_document Mupdf document
+ * @param mupdf_page Mupdf page
+ * @return Array of mupdf_page_image_t or NULL if an error occurred
+ */
+GArray* mupdf_page_get_images(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page);
+
+/**
+ * Drops the collected images of a page. Has to be called with the page mutex
+ * held.
+ *
+ * @param mupdf_page Mupdf page
+ * @param ctx Context of the calling thread
+ */
+void mupdf_page_drop_images(mupdf_page_t* mupdf_page, fz_context* ctx);
+
+/**
+ * Resolves the target of a link. Internal targets are resolved once per
+ * document and kept in mupdf_document_t::destinations, so that named
+ * destinations are only looked up once. Has to be called with the document
+ * mutex held.
+ *
+ * @param mupdf_document Mupdf document
+ * @param ctx Context of the calling thread
+ * @param uri The uri of the link or NULL
+ * @param target Receives the target, its value points into uri
+ * @return The type of the link
+ */
+zathura_link_type_t mupdf_document_resolve_link(mupdf_document_t* mupdf_document, fz_context* ctx, const char* uri,
+                                                zathura_link_target_t* target);
+
+/**
+ * Returns the links of a page, loading and resolving them on first use. Has
+ * to be called with the document mutex held.
+ *
+ * @param mupdf_document Mupdf document
+ * @param mupdf_page Mupdf page
+ * @param ctx Context of the calling thread
+ * @return Array of mupdf_page_link_t or NULL if an error occurred
+ */
+GArray* mupdf_page_get_links(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page, fz_context* ctx);
+
+/**
+ * Drops the resolved links of a page. Has to be called with the document
+ * mutex held.
+ *
+ * @param mupdf_page Mupdf page
+ */
+void mupdf_page_drop_links(mupdf_page_t* mupdf_page);
+
+/**
+ * Checks whether a candidate of mupdf_page_find_annotation is the one looked
+ * for
+ *
+ * @param ctx Context of the calling thread
+ * @param annot The candidate
+ * @param data Data passed to mupdf_page_find_annotation
+ * @return true if the annotation matches
+ */
+typedef bool (*mupdf_annotation_match_t)(fz_context* ctx, pdf_annot* annot, void* data);
+
+/**
+ * Looks up a note or markup annotation by its anchor, the top left corner of
+ * a note's rectangle or of a markup's quads. The page's annotations are put
+ * into a grid on first use, so that only the few around the anchor are
+ * compared. The annotation stays valid as long as the page is loaded. Has to
+ * be called with the document mutex held and may throw.
+ *
+ * @param mupdf_page Mupdf page
+ * @param ctx Context of the calling thread
+ * @param page The loaded page
+ * @param types Types of the annotation as bits of (1 << enum pdf_annot_type)
+ * @param anchor The anchor, matched within ANNOTATION_MATCH_EPS
+ * @param matches Further check of the candidates or NULL
+ * @param data Data passed to matches
+ * @return The annotation or NULL if none matches
+ */
+pdf_annot* mupdf_page_find_annotation(mupdf_page_t* mupdf_page, fz_context* ctx, pdf_page* page, unsigned int types,
+                                      fz_point anchor, mupdf_annotation_match_t matches, void* data);
+
+/**
+ * Adds a created or moved annotation to the grid of its page if the grid
+ * exists. Has to be called with the document mutex held and may throw.
+ *
+ * @param mupdf_page Mupdf page
+ * @param ctx Context of the calling thread
+ * @param annot The annotation
+ */
+void mupdf_page_index_annotation(mupdf_page_t* mupdf_page, fz_context* ctx, pdf_annot* annot);
+
+/**
+ * Removes an annotation from the grid of its page before it is deleted or
+ * moved. Has to be called with the document mutex held and may throw.
+ *
+ * @param mupdf_page Mupdf page
+ * @param ctx Context of the calling thread
+ * @param annot The annotation
+ */
+void mupdf_page_unindex_annotation(mupdf_page_t* mupdf_page, fz_context* ctx, pdf_annot* annot);
+
+/**
+ * Drops the grid of a page's annotations, it has to be dropped together with
+ * the page. Has to be called with the document mutex held.
+ *
+ * @param mupdf_page Mupdf page
+ */
+void mupdf_page_drop_annotation_index(mupdf_page_t* mupdf_page);
+
+/* annotations to be created on one page */
+typedef struct mupdf_annotation_batch_s {
+  mupdf_page_t* page;   /**< Page the annotations are created on */
+  GPtrArray* items;     /**< Descriptions of the annotations */
+  unsigned int created; /**< Number of annotations created */
+} mupdf_annotation_batch_t;
+
+/**
+ * Creates an annotation from its description without synthesizing its
+ * appearance. May throw.
+ *
+ * @param ctx Context of the calling thread
+ * @param page The page
+ * @param item The description
+ * @return A new reference to the annotation or NULL if the description is
+ *   skipped
+ */
+typedef pdf_annot* (*mupdf_annotation_create_t)(fz_context* ctx, pdf_page* page, void* item);
+
+/**
+ * Creates the annotations of several pages in one operation of the undo
+ * journal. The appearances of each page's new annotations are synthesized in
+ * one pass after all of them exist. Has to be called without holding the
+ * document mutex.
+ *
+ * @param mupdf_document Mupdf document
+ * @param batches The batches, their created counts are set
+ * @param n_batches Number of batches
+ * @param operation Name of the operation in the undo journal
+ * @param create Creates one annotation
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t mupdf_document_create_annotations(mupdf_document_t* mupdf_document, mupdf_annotation_batch_t* batches,
+                                                  unsigned int n_batches, const char* operation,
+                                                  mupdf_annotation_create_t create);
+
+/**
+ * Indexes the files embedded in the document on first use. The index is read
+ * from the EmbeddedFiles name tree; only documents without one are scanned for
+ * embedded file specifications. Has to be called with the document mutex held.
+ *
+ * @param mupdf_document Mupdf document
+ * @param ctx Context of the calling thread
+ * @return true if mupdf_document_t::attachments is available
+ */
+bool mupdf_document_index_attachments(mupdf_document_t* mupdf_document, fz_context* ctx);
+
+/**
+ * Drops the index of the embedded files. Has to be called with the document
+ * mutex held.
+ *
+ * @param mupdf_document Mupdf document
+ * @param ctx Context of the calling thread
+ */
+void mupdf_document_drop_attachments(mupdf_document_t* mupdf_document, fz_context* ctx);
+
+/**
+ * Returns the path of a file in the cache directory that belongs to the
+ * document. The path is keyed by the document's ID, size and modification
+ * time, so that it changes with the file. Has to be called with the document
+ * mutex held unless ctx is the only context in use.
+ *
+ * @param mupdf_document Mupdf document
+ * @param ctx Context of the calling thread
+ * @param path Path of the document file
+ * @param variant Format of the cached data, part of the key, or NULL
+ * @param suffix Appended to the file name
+ * @return The path (needs to be deallocated with g_free) or NULL if the
+ *   document has no key
+ */
+gchar* mupdf_document_get_cache_path(mupdf_document_t* mupdf_document, fz_context* ctx, const char* path,
+                                     const char* variant, const char* suffix);
+
+/**
+ * Decodes an image into a cairo surface that fits into the given size. The
+ * image is decoded at the smallest resolution that still covers the size.
+ *
+ * @param ctx Context of the calling thread
+ * @param image The image
+ * @param width Maximal width or 0 to derive it from the height
+ * @param height Maximal height or 0 to derive it from the width
+ * @return The cairo image surface or NULL if an error occurred. Images are
+ *   never enlarged, both sizes 0 return the image at its native resolution.
+ */
+cairo_surface_t* mupdf_image_get_cairo(fz_context* ctx, fz_image* image, int width, int height);
 
 #endif // UTILS_H
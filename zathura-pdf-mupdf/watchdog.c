@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: Zlib */
+
+#include "watchdog.h"
+
+static gpointer mupdf_watchdog_run(gpointer data) {
+  mupdf_watchdog_t* watchdog = data;
+
+  g_mutex_lock(&watchdog->mutex);
+  while (watchdog->quit == false) {
+    if (watchdog->watch->len == 0) {
+      g_cond_wait(&watchdog->cond, &watchdog->mutex);
+      continue;
+    }
+
+    /* mupdf polls the abort flag of the cookies while it interprets and draws; the visibility is read without
+     * synchronization, so only a page that was visible and then left the view counts as scrolled away */
+    for (guint i = 0; i < watchdog->watch->len; i++) {
+      mupdf_watch_t* watch = g_ptr_array_index(watchdog->watch, i);
+      if (zathura_page_get_visibility(watch->page) == true) {
+        watch->was_visible = true;
+      } else if (watch->was_visible == true) {
+        for (unsigned int c = 0; c < watch->n_cookies; c++) {
+          watch->cookies[c].abort = 1;
+        }
+      }
+    }
+
+    g_cond_wait_until(&watchdog->cond, &watchdog->mutex,
+                      g_get_monotonic_time() + WATCHDOG_INTERVAL * G_TIME_SPAN_MILLISECOND);
+  }
+  g_mutex_unlock(&watchdog->mutex);
+
+  return NULL;
+}
+
+mupdf_watchdog_t* mupdf_watchdog_new(void) {
+  mupdf_watchdog_t* watchdog = g_malloc0(sizeof(mupdf_watchdog_t));
+
+  g_mutex_init(&watchdog->mutex);
+  g_cond_init(&watchdog->cond);
+  watchdog->watch = g_ptr_array_new();
+
+  return watchdog;
+}
+
+void mupdf_watchdog_free(mupdf_watchdog_t* watchdog) {
+  if (watchdog == NULL) {
+    return;
+  }
+
+  g_mutex_lock(&watchdog->mutex);
+  watchdog->quit = true;
+  g_cond_signal(&watchdog->cond);
+  g_mutex_unlock(&watchdog->mutex);
+
+  if (watchdog->thread != NULL) {
+    g_thread_join(watchdog->thread);
+  }
+
+  g_ptr_array_free(watchdog->watch, TRUE);
+  g_cond_clear(&watchdog->cond);
+  g_mutex_clear(&watchdog->mutex);
+  g_free(watchdog);
+}
+
+void mupdf_watchdog_add(mupdf_watchdog_t* watchdog, mupdf_watch_t* watch) {
+  g_mutex_lock(&watchdog->mutex);
+  if (watchdog->thread == NULL) {
+    watchdog->thread = g_thread_try_new("mupdf-watchdog", mupdf_watchdog_run, watchdog, NULL);
+  }
+  g_ptr_array_add(watchdog->watch, watch);
+  g_cond_signal(&watchdog->cond);
+  g_mutex_unlock(&watchdog->mutex);
+}
+
+bool mupdf_watchdog_remove(mupdf_watchdog_t* watchdog, mupdf_watch_t* watch) {
+  g_mutex_lock(&watchdog->mutex);
+  g_ptr_array_remove_fast(watchdog->watch, watch);
+
+  bool aborted = false;
+  for (unsigned int c = 0; c < watch->n_cookies; c++) {
+    aborted = aborted || watch->cookies[c].abort != 0;
+  }
+  g_mutex_unlock(&watchdog->mutex);
+
+  return aborted;
+}
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: Zlib */
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stdbool.h>
+#include <glib.h>
+#include <mupdf/fitz.h>
+#include <zathura/plugin-api.h>
+
+/* milliseconds between two visibility checks */
+#define WATCHDOG_INTERVAL 50
+
+typedef struct mupdf_watch_s {
+  zathura_page_t* page;   /**< Page being rendered */
+  fz_cookie* cookies;     /**< Cookies of the render, all are aborted together */
+  unsigned int n_cookies; /**< Number of cookies */
+  bool was_visible;       /**< If the page was seen visible during the render; guarded by the watchdog's mutex */
+} mupdf_watch_t;
+
+typedef struct mupdf_watchdog_s {
+  GMutex mutex;     /**< Guards the watchdog */
+  GCond cond;       /**< Signalled when watches are added or the thread has to quit */
+  GPtrArray* watch; /**< Watched renders as mupdf_watch_t */
+  GThread* thread;  /**< Checks the watched pages, started with the first watch */
+  bool quit;        /**< Set to stop the thread */
+} mupdf_watchdog_t;
+
+/**
+ * Creates a watchdog that aborts renders of pages which are no longer visible.
+ * Zathura flags the visibility of its pages from the main thread without any
+ * synchronization, so the watchdog only reads a hint: a render is aborted once
+ * its page was seen visible and is then seen invisible, a page that was never
+ * flagged visible is rendered to the end.
+ *
+ * @return The watchdog
+ */
+mupdf_watchdog_t* mupdf_watchdog_new(void);
+
+/**
+ * Stops the watchdog and frees it. No renders may be watched anymore.
+ *
+ * @param watchdog The watchdog
+ */
+void mupdf_watchdog_free(mupdf_watchdog_t* watchdog);
+
+/**
+ * Starts watching a render. Its cookies are aborted once the page was
+ * visible and left the view.
+ *
+ * @param watchdog The watchdog
+ * @param watch The render, has to stay valid until mupdf_watchdog_remove
+ */
+void mupdf_watchdog_add(mupdf_watchdog_t* watchdog, mupdf_watch_t* watch);
+
+/**
+ * Stops watching a render
+ *
+ * @param watchdog The watchdog
+ * @param watch The render
+ * @return true if the render was aborted
+ */
+bool mupdf_watchdog_remove(mupdf_watchdog_t* watchdog, mupdf_watch_t* watch);
+
+#endif // WATCHDOG_H